@@ -3,7 +3,14 @@
 
 #include "colcon_build_job.h"
 
+#include "colcon_build_settings.h"
+
 #include <KLocalizedString>
+#include <KShell>
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
 
 #include <interfaces/iproject.h>
 #include <outputview/outputdelegate.h>
@@ -16,7 +23,16 @@
 #include <debug.h>
 
 ColconBuildJob::ColconBuildJob(KDevelop::IProject* project, QObject* parent)
+ : ColconBuildJob{project, {}, Mode::Foreground, Selection::Packages, parent}
+{
+}
+
+ColconBuildJob::ColconBuildJob(KDevelop::IProject* project, const QStringList& packages, Mode mode, Selection selection, QObject* parent)
  : OutputExecuteJob{parent}
+ , m_workspace{project->path().parent()}
+ , m_packages{packages}
+ , m_mode{mode}
+ , m_selection{selection}
 {
     setToolTitle(i18n("Colcon"));
     setCapabilities(Killable);
@@ -28,19 +44,335 @@ ColconBuildJob::ColconBuildJob(KDevelop::IProject* project, QObject* parent)
     // We want to get feedback immediately, so switch off line buffering
     addEnvironmentOverride(QStringLiteral("PYTHONUNBUFFERED"), QStringLiteral("1"));
 
+    // The command depends on the resolved parallelism, which may have to
+    // ask distcc first. It is set up in start().
+    m_settings = ColconBuildSettings::fromProject(project);
+
+    m_useCcache = m_settings.useCcache;
+    m_ccacheDirectory = m_settings.ccacheDirectory;
+    if(m_settings.isDistributed())
+        m_distributedLog = KDevelop::Path(m_workspace, QStringLiteral("build/kdev_colcon_distributed.log")).toLocalFile();
+
+    if(mode == Mode::Background)
+        setVerbosity(Silent);
+
+    QString title;
+    if(mode == Mode::Background)
+        title = i18nc("Building in background: <packages>", "Building in background: %1", packages.join(QStringLiteral(", ")));
+    else
+        title = i18nc("Building: <project name>", "Building: %1", project->name());
+    setJobName(title);
+
+    setWorkingDirectory(m_workspace.toUrl());
+}
+
+void ColconBuildJob::start()
+{
+    m_timing.load(timingFile());
+
+    // Start with a fresh log, so it only contains this build
+    if(!m_distributedLog.isEmpty())
+        QFile::remove(m_distributedLog);
+
+    // The automatic parallelism of distcc builds depends on its host list
+    if(!m_settings.needsDistccCapacity())
+    {
+        setupCommand(m_settings.resolved());
+        startBuild();
+        return;
+    }
+
+    ColconBuildSettings::distccCapacity(this, [this](int capacity) {
+        if(m_killed)
+            return;
+
+        setupCommand(m_settings.resolved(capacity));
+        startBuild();
+    });
+}
+
+void ColconBuildJob::setupCommand(const ColconBuildSettings& settings)
+{
+    m_parallelWorkers = settings.parallelWorkers;
+
+    // colcon-cmake only adds its own -j/-l if MAKEFLAGS does not contain
+    // them, and ninja does not read MAKEFLAGS at all. cmake --build passes
+    // CMAKE_BUILD_PARALLEL_LEVEL on to both make and ninja as -j.
+    addEnvironmentOverride(QStringLiteral("CMAKE_BUILD_PARALLEL_LEVEL"), QString::number(settings.jobsPerPackage));
+
+    // The load limit keeps later packages from piling on more jobs while
+    // the machine is already saturated. It only reaches make, there is no
+    // way to hand it to ninja through colcon, but the memory wait below
+    // applies to both. Distributed builds are limited by the remote
+    // capacity instead, which is already reflected in -j.
+    if(settings.isDistributed())
+        addEnvironmentOverride(QStringLiteral("MAKEFLAGS"), QStringLiteral("-j%1").arg(settings.jobsPerPackage));
+    else
+    {
+        addEnvironmentOverride(QStringLiteral("MAKEFLAGS"), QStringLiteral("-j%1 -l%2")
+            .arg(settings.jobsPerPackage).arg(ColconBuildSettings::loadLimit()));
+    }
+
+    // The launchers only wrap compilation, so linking always stays local.
+    // Without pump mode, distcc and icecc also preprocess locally.
+    QString launcher = settings.distributedCompiler;
+
+    // The automatic split is based on the memory available when the build
+    // starts. Packages with heavier translation units would still push
+    // the machine into swap, so each compiler waits until there is room.
+    if(m_settings.waitsForMemory())
+    {
+        launcher = memoryWaitScript();
+        addEnvironmentOverride(QStringLiteral("KDEV_COLCON_MEMORY_PER_JOB"), QString::number(settings.memoryPerJob));
+    }
+
+    // The clients log where each compilation ran
+    if(settings.distributedCompiler == QLatin1String("distcc"))
+    {
+        addEnvironmentOverride(QStringLiteral("DISTCC_LOG"), m_distributedLog);
+        addEnvironmentOverride(QStringLiteral("DISTCC_VERBOSE"), QStringLiteral("1"));
+    }
+    else if(settings.distributedCompiler == QLatin1String("icecc"))
+    {
+        addEnvironmentOverride(QStringLiteral("ICECC_LOGFILE"), m_distributedLog);
+        addEnvironmentOverride(QStringLiteral("ICECC_DEBUG"), QStringLiteral("debug"));
+    }
+
+    if(m_useCcache)
+    {
+        // ccache calls the distributed compiler or the memory wait itself
+        // on a cache miss
+        if(!launcher.isEmpty())
+            addEnvironmentOverride(QStringLiteral("CCACHE_PREFIX"), launcher);
+        launcher = QStringLiteral("ccache");
+
+        if(!settings.ccacheDirectory.isEmpty())
+            addEnvironmentOverride(QStringLiteral("CCACHE_DIR"), settings.ccacheDirectory);
+        if(!settings.ccacheMaxSize.isEmpty())
+            addEnvironmentOverride(QStringLiteral("CCACHE_MAXSIZE"), settings.ccacheMaxSize);
+    }
+
+    QString command = QStringLiteral("./.build.sh --parallel-workers %1").arg(settings.parallelWorkers);
+    if(!m_packages.isEmpty())
+    {
+        QStringList quoted;
+        for(const QString& package : qAsConst(m_packages))
+            quoted << KShell::quoteArg(package);
+
+        if(m_selection == Selection::PackagesAbove)
+            command += QStringLiteral(" --packages-above ");
+        else
+            command += QStringLiteral(" --packages-select ");
+        command += quoted.join(QLatin1Char(' '));
+    }
+
+    // Stay out of the way of the editor and the parser
+    if(m_mode == Mode::Background)
+        command.prepend(QStringLiteral("nice -n 19 ionice -c 2 -n 7 "));
+
+    // The start/end messages tell us which packages were actually built.
+    command += QStringLiteral(" --event-handlers status+ console_start_end+");
+
     // We need a post-processing step with tr, since colcon separates its status
     // line prints with \r, which is not recognized as a line delimiter by
     // KDevelop's line splitter...
+    command += QStringLiteral(" | stdbuf -o0 tr '\\r' '\\n'");
+
+    // Passing the launchers with --cmake-args would replace the arguments
+    // .build.sh passes, so they go through the environment. CMake only
+    // reads it when it creates a new cache, so we drop the cache of every
+    // package that was configured with other launchers by us. The stamp
+    // next to the cache records what we used, packages we never set
+    // launchers for are left alone. pipefail reports the exit code of
+    // colcon instead of the one of tr.
+    if(!launcher.isEmpty())
+    {
+        addEnvironmentOverride(QStringLiteral("CMAKE_C_COMPILER_LAUNCHER"), launcher);
+        addEnvironmentOverride(QStringLiteral("CMAKE_CXX_COMPILER_LAUNCHER"), launcher);
+    }
+    addEnvironmentOverride(QStringLiteral("KDEV_COLCON_LAUNCHER"), launcher);
+
+    const QString script = QStringLiteral(
+        "set -o pipefail\n"
+        "for cache in build/*/CMakeCache.txt; do\n"
+        "    [ -f \"$cache\" ] || continue\n"
+        "    stamp=\"${cache%/*}/kdev_colcon_launcher\"\n"
+        "    [ \"$(cat \"$stamp\" 2>/dev/null)\" = \"$KDEV_COLCON_LAUNCHER\" ] && continue\n"
+        "    rm -f \"$cache\"\n"
+        "    printf '%s' \"$KDEV_COLCON_LAUNCHER\" > \"$stamp\"\n"
+        "done\n"
+        "%1\n"
+        "status=$?\n"
+        "for cache in build/*/CMakeCache.txt; do\n"
+        "    stamp=\"${cache%/*}/kdev_colcon_launcher\"\n"
+        "    [ -f \"$cache\" ] && [ ! -e \"$stamp\" ] && printf '%s' \"$KDEV_COLCON_LAUNCHER\" > \"$stamp\"\n"
+        "done\n"
+        "exit $status\n"
+    ).arg(command);
+
+    // Killing the job only terminates the bash we start here. The build
+    // runs in its own process group, which gets the signal passed on, so
+    // colcon and the compilers do not keep running in the workspace.
+    const QString wrapper = QStringLiteral(
+        "setsid bash -c \"$1\" &\n"
+        "pid=$!\n"
+        "trap 'kill -TERM -- -$pid 2>/dev/null; exit 143' TERM\n"
+        "wait $pid\n"
+    );
+
     *this << "bash"
         << "-c"
-        << "./.build.sh"
-        " --event-handlers status+ console_start_end-"
-        " | stdbuf -o0 tr '\\r' '\\n'";
+        << wrapper
+        << "kdev_colcon"
+        << script;
+}
 
-    QString title = i18nc("Building: <project name>", "Building: %1", project->name());
-    setJobName(title);
+void ColconBuildJob::startBuild()
+{
+    if(!m_useCcache)
+    {
+        startProcess();
+        return;
+    }
+
+    ColconCcacheStats::read(m_ccacheDirectory, this, [this](const ColconCcacheStats& stats) {
+        m_ccacheBefore = stats;
+        startProcess();
+    });
+}
+
+bool ColconBuildJob::doKill()
+{
+    // We might still be waiting for distcc or ccache before the process is
+    // started
+    m_killed = true;
+    return OutputExecuteJob::doKill();
+}
+
+void ColconBuildJob::startProcess()
+{
+    if(m_killed)
+        return;
+
+    m_elapsed.start();
+    OutputExecuteJob::start();
+}
+
+void ColconBuildJob::childProcessExited(int exitCode, QProcess::ExitStatus exitStatus)
+{
+    m_timing.readDependencies(KDevelop::Path(m_workspace, QStringLiteral("log/latest_build/events.log")).toLocalFile());
+
+    model()->appendLines(m_timing.report(m_parallelWorkers));
 
-    setWorkingDirectory(project->path().parent().toUrl());
+    if(!m_distributedLog.isEmpty())
+        reportDistributedStats();
+
+    if(!m_useCcache)
+    {
+        m_timing.save(timingFile());
+        OutputExecuteJob::childProcessExited(exitCode, exitStatus);
+        return;
+    }
+
+    ColconCcacheStats::read(m_ccacheDirectory, this, [this, exitCode, exitStatus](const ColconCcacheStats& stats) {
+        reportCcacheStats(stats - m_ccacheBefore);
+        m_timing.save(timingFile());
+        OutputExecuteJob::childProcessExited(exitCode, exitStatus);
+    });
+}
+
+QString ColconBuildJob::memoryWaitScript() const
+{
+    // Only one waiting compiler is let through at a time, and it gets a
+    // moment to grow before the next one looks at the memory again.
+    // Otherwise all of them would start at once as soon as memory frees
+    // up. Gives up after five minutes, in case something else holds on to
+    // the memory.
+    static const QByteArray contents =
+        "#!/bin/sh\n"
+        "# Written by kdev_colcon, see ColconBuildJob::memoryWaitScript()\n"
+        "need=${KDEV_COLCON_MEMORY_PER_JOB:-0}\n"
+        "exec 9> \"${0%/*}/kdev_colcon_memory.lock\"\n"
+        "flock 9 2>/dev/null\n"
+        "waited=0\n"
+        "while [ \"$waited\" -lt 300 ]; do\n"
+        "    available=$(awk '/^MemAvailable:/ { print int($2 / 1024) }' /proc/meminfo 2>/dev/null)\n"
+        "    if [ -z \"$available\" ] || [ \"$available\" -ge \"$need\" ]; then\n"
+        "        break\n"
+        "    fi\n"
+        "    sleep 1\n"
+        "    waited=$((waited + 1))\n"
+        "done\n"
+        "[ \"$waited\" -gt 0 ] && sleep 2\n"
+        "exec 9>&-\n"
+        "exec \"$@\"\n";
+
+    const QString path = KDevelop::Path(m_workspace, QStringLiteral("build/kdev_colcon_wait_for_memory.sh")).toLocalFile();
+
+    // Compilers of a build started outside of KDevelop might be running it
+    QFile file(path);
+    if(file.open(QFile::ReadOnly) && file.readAll() == contents)
+        return path;
+    file.close();
+
+    QDir().mkpath(QFileInfo(path).path());
+    if(!file.open(QFile::WriteOnly | QFile::Truncate) || file.write(contents) != contents.size())
+    {
+        qCWarning(COLCON) << "Could not write" << path << ":" << file.errorString();
+        return {};
+    }
+    file.setPermissions(file.permissions() | QFile::ExeOwner | QFile::ExeGroup | QFile::ExeOther);
+
+    return path;
+}
+
+QString ColconBuildJob::timingFile() const
+{
+    return KDevelop::Path(m_workspace, QStringLiteral("build/kdev_colcon_timing.json")).toLocalFile();
+}
+
+void ColconBuildJob::reportDistributedStats()
+{
+    const ColconDistccStats stats = (m_settings.distributedCompiler == QLatin1String("icecc"))
+        ? ColconDistccStats::readIcecc(m_distributedLog)
+        : ColconDistccStats::readDistcc(m_distributedLog);
+    if(!stats.isValid)
+        return;
+
+    const QString message = i18nc("<distributed compiler>: ...", "%1: %2 compilations remote, %3 local",
+        m_settings.distributedCompiler, stats.remote, stats.local);
+
+    model()->appendLine(message);
+    infoMessage(this, message);
+}
+
+void ColconBuildJob::reportCcacheStats(const ColconCcacheStats& stats)
+{
+    if(!stats.isValid)
+        return;
+
+    const qint64 total = stats.hits + stats.misses;
+    const double rate = total ? 100.0 * stats.hits / total : 0.0;
+
+    // ccache does not know how long a compilation takes, so use the average
+    // learned from earlier builds.
+    const qint64 cost = m_timing.compilationCost();
+    m_timing.recordCompilations(stats.misses, stats.hits);
+
+    QString message;
+    if(cost > 0)
+    {
+        message = i18n("ccache: %1 hits, %2 misses (%3% hit rate), about %4 s saved",
+            stats.hits, stats.misses, QString::number(rate, 'f', 1), stats.hits * cost / 1000);
+    }
+    else
+    {
+        message = i18n("ccache: %1 hits, %2 misses (%3% hit rate)",
+            stats.hits, stats.misses, QString::number(rate, 'f', 1));
+    }
+
+    model()->appendLine(message);
+    infoMessage(this, message);
 }
 
 void ColconBuildJob::postProcessStderr(const QStringList& lines)
@@ -57,6 +389,12 @@ void ColconBuildJob::appendLines(const QStringList& lines)
 {
     static const QRegularExpression re(QStringLiteral(
         R"EOS(^\[[^\]]+\] \[([0-9]+)\/([0-9]+) complete\](.*))EOS"));
+    static const QRegularExpression startedRe(QStringLiteral(
+        R"EOS(^Starting >>> (\S+))EOS"));
+    static const QRegularExpression finishedRe(QStringLiteral(
+        R"EOS(^Finished <<< (\S+))EOS"));
+
+    const qint64 now = m_elapsed.elapsed();
 
     QStringList ret(lines);
     for(QStringList::iterator it = ret.begin(); it != ret.end(); )
@@ -82,7 +420,20 @@ void ColconBuildJob::appendLines(const QStringList& lines)
             it = ret.erase(it);
         }
         else
+        {
+            QRegularExpressionMatch match = startedRe.match(*it);
+            if(match.hasMatch())
+                m_timing.packageStarted(match.captured(1), now);
+
+            match = finishedRe.match(*it);
+            if(match.hasMatch())
+            {
+                m_timing.packageFinished(match.captured(1), now);
+                emit packageBuilt(match.captured(1));
+            }
+
             it++;
+        }
     }
 
     model()->appendLines(ret);
@@ -4,9 +4,17 @@
 #ifndef COLCON_BUILD_JOB_H
 #define COLCON_BUILD_JOB_H
 
+#include "colcon_build_settings.h"
+#include "colcon_build_timing.h"
+#include "colcon_ccache_stats.h"
+#include "colcon_distcc_stats.h"
+
 #include <outputview/outputexecutejob.h>
+#include <util/path.h>
 
+#include <QElapsedTimer>
 #include <QProcess>
+#include <QStringList>
 
 namespace KDevelop
 {
@@ -22,14 +30,66 @@ public:
         Failed
     };
 
+    enum class Mode {
+        Foreground,
+        Background ///< Reduced CPU and I/O priority, does not raise the output view
+    };
+
+    enum class Selection {
+        Packages, ///< Only the given packages (--packages-select)
+        PackagesAbove ///< The given packages and everything depending on them (--packages-above)
+    };
+
     explicit ColconBuildJob(KDevelop::IProject* project, QObject* parent = nullptr);
 
+    /// Build only the given packages (all if empty)
+    ColconBuildJob(KDevelop::IProject* project, const QStringList& packages, Mode mode, Selection selection, QObject* parent = nullptr);
+
+    void start() override;
+
+    /// Packages given to the constructor
+    QStringList packages() const
+    { return m_packages; }
+
+Q_SIGNALS:
+    /// colcon reported package as finished
+    void packageBuilt(const QString& package);
+
 protected Q_SLOTS:
     void postProcessStdout(const QStringList& lines) override;
     void postProcessStderr(const QStringList& lines) override;
+    void childProcessExited(int exitCode, QProcess::ExitStatus exitStatus) override;
+
+protected:
+    bool doKill() override;
 
 private:
+    void setupCommand(const ColconBuildSettings& settings);
+    void startBuild();
+    void startProcess();
     void appendLines(const QStringList& lines);
+    void reportCcacheStats(const ColconCcacheStats& stats);
+    void reportDistributedStats();
+    QString memoryWaitScript() const;
+    QString timingFile() const;
+
+    KDevelop::Path m_workspace;
+    QStringList m_packages;
+    Mode m_mode;
+    Selection m_selection;
+    ColconBuildSettings m_settings;
+    int m_parallelWorkers = 1;
+    bool m_killed = false;
+
+    QElapsedTimer m_elapsed;
+    ColconBuildTiming m_timing;
+
+    bool m_useCcache = false;
+    QString m_ccacheDirectory;
+    ColconCcacheStats m_ccacheBefore;
+
+    /// Client log of distcc or icecc
+    QString m_distributedLog;
 };
 
 #endif
@@ -0,0 +1,169 @@
+// Build parallelism settings
+// Author: Max Schwarz <max.schwarz@online.de>
+
+#include "colcon_build_settings.h"
+
+#include <interfaces/iproject.h>
+
+#include <KConfigGroup>
+#include <KSharedConfig>
+
+#include <QFile>
+#include <QProcess>
+#include <QThread>
+#include <QTimer>
+
+#include <algorithm>
+#include <cmath>
+
+#include <debug.h>
+
+ColconBuildSettings ColconBuildSettings::fromProject(KDevelop::IProject* project)
+{
+    ColconBuildSettings settings;
+
+    KConfigGroup group = project->projectConfiguration()->group("Colcon");
+    settings.parallelWorkers = std::max(0, group.readEntry("Parallel Workers", 0));
+    settings.jobsPerPackage = std::max(0, group.readEntry("Jobs Per Package", 0));
+    settings.memoryPerJob = std::max(1, group.readEntry("Memory Per Job", settings.memoryPerJob));
+    settings.testWorkers = std::max(0, group.readEntry("Test Workers", 0));
+    settings.useCcache = group.readEntry("Use Ccache", false);
+    settings.ccacheDirectory = group.readEntry("Ccache Directory", QString());
+    settings.ccacheMaxSize = group.readEntry("Ccache Max Size", QString());
+    settings.buildOnSave = group.readEntry("Build On Save", false);
+    settings.buildOnSaveDelay = std::max(0, group.readEntry("Build On Save Delay", settings.buildOnSaveDelay));
+    settings.distributedCompiler = group.readEntry("Distributed Compiler", QString());
+    settings.distributedJobs = std::max(0, group.readEntry("Distributed Jobs", 0));
+
+    if(settings.isDistributed()
+        && settings.distributedCompiler != QLatin1String("distcc")
+        && settings.distributedCompiler != QLatin1String("icecc"))
+    {
+        qCWarning(COLCON) << "Unknown distributed compiler" << settings.distributedCompiler << ", building locally";
+        settings.distributedCompiler.clear();
+    }
+
+    return settings;
+}
+
+bool ColconBuildSettings::needsDistccCapacity() const
+{
+    const bool automatic = parallelWorkers <= 0 || jobsPerPackage <= 0;
+    return automatic && distributedCompiler == QLatin1String("distcc") && distributedJobs <= 0;
+}
+
+ColconBuildSettings ColconBuildSettings::resolved(int distccJobs) const
+{
+    ColconBuildSettings ret = *this;
+
+    const int cores = std::max(1, QThread::idealThreadCount());
+
+    // Tests are mostly single-threaded, so one package per core
+    if(ret.testWorkers <= 0)
+        ret.testWorkers = cores;
+
+    if(ret.parallelWorkers > 0 && ret.jobsPerPackage > 0)
+        return ret;
+
+    // Total number of compiler processes the machine can sustain
+    int budget = cores;
+    const qint64 memory = availableMemory();
+    if(isDistributed())
+    {
+        // Compilers run remotely, so local memory is not the limit
+        if(distributedJobs > 0)
+            budget = distributedJobs;
+        else if(distributedCompiler == QLatin1String("distcc"))
+            budget = std::max(cores, distccJobs);
+    }
+    else if(memory > 0)
+        budget = std::min<qint64>(budget, memory / memoryPerJob);
+    budget = std::max(1, budget);
+
+    if(ret.parallelWorkers <= 0 && ret.jobsPerPackage <= 0)
+    {
+        // Split the budget evenly between package-level and
+        // compiler-level parallelism.
+        ret.parallelWorkers = std::max(1, int(std::lround(std::sqrt(budget))));
+        ret.jobsPerPackage = std::max(1, budget / ret.parallelWorkers);
+    }
+    else if(ret.parallelWorkers <= 0)
+        ret.parallelWorkers = std::max(1, budget / ret.jobsPerPackage);
+    else
+        ret.jobsPerPackage = std::max(1, budget / ret.parallelWorkers);
+
+    qCDebug(COLCON) << "Build parallelism:" << cores << "cores," << memory << "MiB available ->"
+        << ret.parallelWorkers << "workers," << ret.jobsPerPackage << "jobs per package";
+
+    return ret;
+}
+
+int ColconBuildSettings::loadLimit()
+{
+    return std::max(1, QThread::idealThreadCount());
+}
+
+qint64 ColconBuildSettings::availableMemory()
+{
+    QFile f(QStringLiteral("/proc/meminfo"));
+    if(!f.open(QFile::ReadOnly | QFile::Text))
+        return -1;
+
+    while(!f.atEnd())
+    {
+        const QByteArray line = f.readLine();
+        if(!line.startsWith("MemAvailable:"))
+            continue;
+
+        // Format: "MemAvailable:   12345678 kB"
+        const QList<QByteArray> parts = line.simplified().split(' ');
+        if(parts.size() < 2)
+            return -1;
+
+        bool ok = false;
+        const qint64 kb = parts[1].toLongLong(&ok);
+        return ok ? kb / 1024 : -1;
+    }
+
+    return -1;
+}
+
+void ColconBuildSettings::distccCapacity(QObject* context, const std::function<void(int)>& callback)
+{
+    // Deletes itself when done, even if context is gone by then
+    auto process = new QProcess;
+
+    const auto finished = QOverload<int, QProcess::ExitStatus>::of(&QProcess::finished);
+    QObject::connect(process, finished, context, [process, callback](int exitCode, QProcess::ExitStatus exitStatus) {
+        if(exitStatus != QProcess::NormalExit || exitCode != 0)
+        {
+            qCWarning(COLCON) << "Could not query distcc capacity:" << process->errorString();
+            callback(-1);
+            return;
+        }
+
+        bool ok = false;
+        const int jobs = process->readAllStandardOutput().trimmed().toInt(&ok);
+        callback(ok ? jobs : -1);
+    });
+    QObject::connect(process, finished, process, &QObject::deleteLater);
+
+    // A process that failed to start does not emit finished()
+    QObject::connect(process, &QProcess::errorOccurred, context, [process, callback](QProcess::ProcessError error) {
+        if(error != QProcess::FailedToStart)
+            return;
+
+        qCWarning(COLCON) << "Could not run distcc:" << process->errorString();
+        callback(-1);
+    });
+    QObject::connect(process, &QProcess::errorOccurred, process, [process](QProcess::ProcessError error) {
+        if(error == QProcess::FailedToStart)
+            process->deleteLater();
+    });
+
+    QTimer::singleShot(2000, process, [process]() {
+        process->kill();
+    });
+
+    process->start(QStringLiteral("distcc"), {QStringLiteral("-j")});
+}
@@ -0,0 +1,97 @@
+// Build parallelism settings
+// Author: Max Schwarz <max.schwarz@online.de>
+
+#ifndef COLCON_BUILD_SETTINGS_H
+#define COLCON_BUILD_SETTINGS_H
+
+#include <QString>
+
+#include <functional>
+
+class QObject;
+
+namespace KDevelop
+{
+    class IProject;
+}
+
+/**
+ * Settings for colcon builds, read from the "Colcon" group of the project
+ * configuration (keys "Parallel Workers", "Jobs Per Package",
+ * "Memory Per Job", "Test Workers", "Use Ccache", "Ccache Directory",
+ * "Ccache Max Size", "Build On Save", "Build On Save Delay",
+ * "Distributed Compiler" and "Distributed Jobs"). A value of zero for
+ * parallelWorkers, jobsPerPackage or testWorkers selects automatic mode
+ * for that value.
+ */
+class ColconBuildSettings
+{
+public:
+    /// Number of packages colcon builds at once (--parallel-workers)
+    int parallelWorkers = 0;
+
+    /// Number of compiler processes per package (make/ninja -j)
+    int jobsPerPackage = 0;
+
+    /// Expected peak memory of one compiler process in MiB
+    int memoryPerJob = 2048;
+
+    /// Number of packages colcon tests at once
+    int testWorkers = 0;
+
+    /// Compile through ccache
+    bool useCcache = false;
+
+    /// ccache directory and size limit (e.g. "20G"), empty for ccache's defaults
+    QString ccacheDirectory;
+    QString ccacheMaxSize;
+
+    /// Build the package of a file in the background after it was saved
+    bool buildOnSave = false;
+
+    /// Time in ms to wait for further saves before starting the build
+    int buildOnSaveDelay = 1500;
+
+    /// Compiler wrapper for distributed builds ("distcc" or "icecc"),
+    /// empty for local builds
+    QString distributedCompiler;
+
+    /// Total number of compile jobs for distributed builds, zero asks
+    /// distcc for the capacity of its host list
+    int distributedJobs = 0;
+
+    bool isDistributed() const
+    { return !distributedCompiler.isEmpty(); }
+
+    /// Whether compiler starts are held back while memory is short. This
+    /// is part of the automatic mode for local builds, since the memory a
+    /// package needs is only known once it compiles.
+    bool waitsForMemory() const
+    { return !isDistributed() && (parallelWorkers <= 0 || jobsPerPackage <= 0); }
+
+    static ColconBuildSettings fromProject(KDevelop::IProject* project);
+
+    /// Whether resolved() should be given distcc's capacity
+    bool needsDistccCapacity() const;
+
+    /**
+     * Fill in automatic values from the machine's core count and available
+     * memory, keeping parallelWorkers * jobsPerPackage within both limits.
+     * Distributed builds use the remote capacity instead, distccJobs is
+     * the result of distccCapacity() or -1.
+     */
+    ColconBuildSettings resolved(int distccJobs = -1) const;
+
+    /// Load average above which make stops starting new jobs
+    static int loadLimit();
+
+    /// Currently available system memory in MiB, or -1 if unknown
+    static qint64 availableMemory();
+
+    /// Query the total job capacity of distcc's host list (distcc -j) without
+    /// blocking. The callback gets -1 if unknown and is not invoked if
+    /// context is destroyed first.
+    static void distccCapacity(QObject* context, const std::function<void(int)>& callback);
+};
+
+#endif
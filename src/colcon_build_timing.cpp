@@ -0,0 +1,308 @@
+// Per-package build timing
+// Author: Max Schwarz <max.schwarz@online.de>
+
+#include "colcon_build_timing.h"
+
+#include <KLocalizedString>
+
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMap>
+#include <QRegularExpression>
+#include <QSaveFile>
+#include <QVector>
+
+#include <algorithm>
+#include <functional>
+
+#include <debug.h>
+
+namespace {
+
+QString formatSeconds(qint64 msecs)
+{
+    return QString::number(msecs / 1000.0, 'f', 1);
+}
+
+}
+
+void ColconBuildTiming::packageStarted(const QString& name, qint64 msecs)
+{
+    Package& package = m_packages[name];
+    package.start = msecs;
+    package.end = -1;
+}
+
+void ColconBuildTiming::packageFinished(const QString& name, qint64 msecs)
+{
+    Package& package = m_packages[name];
+    if(package.start < 0)
+    {
+        qCDebug(COLCON) << "Package" << name << "finished without being started";
+        return;
+    }
+
+    package.end = msecs;
+    package.duration = package.end - package.start;
+}
+
+void ColconBuildTiming::readDependencies(const QString& eventsLog)
+{
+    QFile f(eventsLog);
+    if(!f.open(QFile::ReadOnly | QFile::Text))
+    {
+        qCDebug(COLCON) << "Could not open colcon event log" << eventsLog;
+        return;
+    }
+
+    // [0.123456] (pkg) JobQueued: {'identifier': 'pkg', 'dependencies': OrderedDict([('dep', '/ws/install/dep'), ...])}
+    // Newer Python versions print OrderedDict({'dep': '/ws/install/dep', ...}) instead.
+    static const QRegularExpression queuedRe(QStringLiteral(
+        R"EOS(^\[[0-9.]+\] \(([^)]+)\) JobQueued: )EOS"));
+    static const QRegularExpression depRe(QStringLiteral(
+        R"EOS('([^'/]+)'(?:, |: )')EOS"));
+    const QString depKey = QStringLiteral("'dependencies':");
+
+    while(!f.atEnd())
+    {
+        const QString line = QString::fromUtf8(f.readLine());
+
+        QRegularExpressionMatch match = queuedRe.match(line);
+        if(!match.hasMatch())
+            continue;
+
+        const int idx = line.indexOf(depKey, match.capturedEnd());
+        if(idx < 0)
+            continue;
+
+        QStringList dependencies;
+        auto it = depRe.globalMatch(line, idx + depKey.size());
+        while(it.hasNext())
+            dependencies << it.next().captured(1);
+
+        m_packages[match.captured(1)].dependencies = dependencies;
+    }
+}
+
+bool ColconBuildTiming::load(const QString& filename)
+{
+    QFile f(filename);
+    if(!f.open(QFile::ReadOnly))
+        return false;
+
+    QJsonParseError error;
+    const QJsonDocument document = QJsonDocument::fromJson(f.readAll(), &error);
+    if(error.error || !document.isObject())
+    {
+        qCWarning(COLCON) << "Could not parse build timing file" << filename << error.errorString();
+        return false;
+    }
+
+    m_compilationCost = document.object()[QStringLiteral("compilationCost")].toVariant().toLongLong();
+
+    const QJsonObject packages = document.object()[QStringLiteral("packages")].toObject();
+    for(auto it = packages.begin(); it != packages.end(); ++it)
+    {
+        const QJsonObject entry = it.value().toObject();
+
+        Package package;
+        package.duration = entry[QStringLiteral("duration")].toVariant().toLongLong();
+        for(const QJsonValue& dep : entry[QStringLiteral("dependencies")].toArray())
+            package.dependencies << dep.toString();
+
+        m_packages[it.key()] = package;
+    }
+
+    return true;
+}
+
+bool ColconBuildTiming::save(const QString& filename) const
+{
+    QJsonObject packages;
+    for(auto it = m_packages.constBegin(); it != m_packages.constEnd(); ++it)
+    {
+        QJsonObject entry;
+        entry[QStringLiteral("duration")] = it->duration;
+        entry[QStringLiteral("dependencies")] = QJsonArray::fromStringList(it->dependencies);
+        packages[it.key()] = entry;
+    }
+
+    QJsonObject root;
+    root[QStringLiteral("packages")] = packages;
+    root[QStringLiteral("compilationCost")] = m_compilationCost;
+
+    QSaveFile f(filename);
+    if(!f.open(QFile::WriteOnly))
+    {
+        qCWarning(COLCON) << "Could not write build timing file" << filename;
+        return false;
+    }
+
+    f.write(QJsonDocument(root).toJson());
+    return f.commit();
+}
+
+qint64 ColconBuildTiming::builtDuration() const
+{
+    qint64 sum = 0;
+    for(const Package& package : m_packages)
+    {
+        if(package.builtNow())
+            sum += package.duration;
+    }
+
+    return sum;
+}
+
+void ColconBuildTiming::recordCompilations(qint64 compilations, qint64 cacheHits)
+{
+    // Only builds that mostly compiled say much about the cost of a
+    // compilation. Package durations also contain configuring and linking,
+    // which makes this a rough estimate.
+    const qint64 duration = builtDuration();
+    if(compilations <= cacheHits || duration <= 0)
+        return;
+
+    const qint64 cost = duration / compilations;
+    m_compilationCost = m_compilationCost ? (m_compilationCost + cost) / 2 : cost;
+}
+
+QStringList ColconBuildTiming::criticalPath(qint64* length) const
+{
+    // Longest path through the dependency DAG, weighted by package duration
+    QHash<QString, qint64> finish;
+    QHash<QString, QString> predecessor;
+
+    std::function<qint64(const QString&)> visit = [&](const QString& name) -> qint64 {
+        auto known = finish.constFind(name);
+        if(known != finish.constEnd())
+            return *known;
+
+        // Guard against cycles, which colcon would not have built anyway
+        finish[name] = 0;
+
+        const Package package = m_packages.value(name);
+
+        qint64 best = 0;
+        QString bestDep;
+        for(const QString& dep : package.dependencies)
+        {
+            if(!m_packages.contains(dep))
+                continue;
+
+            const qint64 depFinish = visit(dep);
+            if(depFinish > best)
+            {
+                best = depFinish;
+                bestDep = dep;
+            }
+        }
+
+        if(!bestDep.isEmpty())
+            predecessor[name] = bestDep;
+
+        return finish[name] = best + package.duration;
+    };
+
+    QString last;
+    qint64 longest = -1;
+    for(auto it = m_packages.constBegin(); it != m_packages.constEnd(); ++it)
+    {
+        const qint64 value = visit(it.key());
+        if(value > longest)
+        {
+            longest = value;
+            last = it.key();
+        }
+    }
+
+    QStringList path;
+    for(QString name = last; !name.isEmpty(); name = predecessor.value(name))
+        path.prepend(name);
+
+    if(length)
+        *length = std::max<qint64>(0, longest);
+
+    return path;
+}
+
+QStringList ColconBuildTiming::report(int workers) const
+{
+    QStringList lines;
+
+    QVector<QPair<qint64, QString>> built;
+    qint64 buildStart = -1;
+    qint64 buildEnd = -1;
+    for(auto it = m_packages.constBegin(); it != m_packages.constEnd(); ++it)
+    {
+        if(!it->builtNow())
+            continue;
+
+        built.append({it->duration, it.key()});
+        buildStart = (buildStart < 0) ? it->start : std::min(buildStart, it->start);
+        buildEnd = std::max(buildEnd, it->end);
+    }
+
+    if(built.isEmpty())
+        return lines;
+
+    std::sort(built.begin(), built.end(), [](const auto& a, const auto& b) {
+        return a.first > b.first;
+    });
+
+    lines << i18n("Build timing report:");
+
+    lines << i18n("  Slowest packages:");
+    const int count = std::min(10, built.count());
+    for(int i = 0; i < count; ++i)
+        lines << i18n("    %1 s  %2", formatSeconds(built[i].first), built[i].second);
+
+    qint64 pathLength = 0;
+    const QStringList path = criticalPath(&pathLength);
+    lines << i18n("  Critical path (%1 s for a full build): %2",
+        formatSeconds(pathLength), path.join(QStringLiteral(" -> ")));
+
+    // Sweep over start/end events to find how long k workers were busy
+    QMap<qint64, int> events;
+    for(const Package& package : m_packages)
+    {
+        if(!package.builtNow())
+            continue;
+
+        events[package.start] += 1;
+        events[package.end] -= 1;
+    }
+
+    QMap<int, qint64> busyTime;
+    int busy = 0;
+    qint64 last = buildStart;
+    qint64 workTime = 0;
+    for(auto it = events.constBegin(); it != events.constEnd(); ++it)
+    {
+        busyTime[busy] += it.key() - last;
+        workTime += busy * (it.key() - last);
+        busy += it.value();
+        last = it.key();
+    }
+
+    const qint64 wall = buildEnd - buildStart;
+    if(wall > 0)
+    {
+        const double average = double(workTime) / wall;
+        lines << i18n("  Worker utilization: %1 of %2 workers busy on average over %3 s",
+            QString::number(average, 'f', 2), workers, formatSeconds(wall));
+
+        for(auto it = busyTime.constBegin(); it != busyTime.constEnd(); ++it)
+        {
+            if(it.value() <= 0)
+                continue;
+
+            lines << i18n("    %1 busy: %2%", it.key(),
+                QString::number(100.0 * it.value() / wall, 'f', 1));
+        }
+    }
+
+    return lines;
+}
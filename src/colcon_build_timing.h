@@ -0,0 +1,65 @@
+// Per-package build timing
+// Author: Max Schwarz <max.schwarz@online.de>
+
+#ifndef COLCON_BUILD_TIMING_H
+#define COLCON_BUILD_TIMING_H
+
+#include <QHash>
+#include <QStringList>
+
+/**
+ * Collects start and end times of each package from colcon's event stream.
+ *
+ * Durations are persisted across builds, so that packages which were not
+ * rebuilt this time still contribute to the critical path estimate.
+ */
+class ColconBuildTiming
+{
+public:
+    struct Package
+    {
+        /// Offsets in ms from the build start, -1 if not built this time
+        qint64 start = -1;
+        qint64 end = -1;
+
+        /// Duration of the last completed build of this package in ms
+        qint64 duration = 0;
+
+        QStringList dependencies;
+
+        bool builtNow() const
+        { return start >= 0 && end >= start; }
+    };
+
+    void packageStarted(const QString& name, qint64 msecs);
+    void packageFinished(const QString& name, qint64 msecs);
+
+    /// Read the package dependencies from colcon's events.log
+    void readDependencies(const QString& eventsLog);
+
+    /// Load persisted durations and dependencies from a previous build
+    bool load(const QString& filename);
+    bool save(const QString& filename) const;
+
+    /// Sum of the durations of all packages built this time in ms
+    qint64 builtDuration() const;
+
+    /// Learn the average time per compilation from a build with the given
+    /// number of compilations (cache misses) and cache hits
+    void recordCompilations(qint64 compilations, qint64 cacheHits);
+
+    /// Average build time per compilation in ms from earlier builds, 0 if unknown
+    qint64 compilationCost() const
+    { return m_compilationCost; }
+
+    /// Slowest packages, critical path and worker utilization
+    QStringList report(int workers) const;
+
+private:
+    QStringList criticalPath(qint64* length) const;
+
+    QHash<QString, Package> m_packages;
+    qint64 m_compilationCost = 0;
+};
+
+#endif
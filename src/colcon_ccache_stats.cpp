@@ -0,0 +1,94 @@
+// ccache statistics
+// Author: Max Schwarz <max.schwarz@online.de>
+
+#include "colcon_ccache_stats.h"
+
+#include <QProcess>
+#include <QProcessEnvironment>
+#include <QTimer>
+
+#include <debug.h>
+
+namespace {
+
+ColconCcacheStats parseStats(QProcess* process)
+{
+    ColconCcacheStats stats;
+
+    // Format: one "<key>\t<value>" pair per line
+    while(process->canReadLine())
+    {
+        const QList<QByteArray> parts = process->readLine().trimmed().split('\t');
+        if(parts.size() != 2)
+            continue;
+
+        const QByteArray& key = parts[0];
+        const qint64 value = parts[1].toLongLong();
+
+        if(key == "direct_cache_hit" || key == "preprocessed_cache_hit")
+            stats.hits += value;
+        else if(key == "cache_miss")
+            stats.misses += value;
+    }
+
+    stats.isValid = true;
+    return stats;
+}
+
+}
+
+void ColconCcacheStats::read(const QString& cacheDirectory, QObject* context,
+    const std::function<void(const ColconCcacheStats&)>& callback)
+{
+    // Deletes itself when done, even if context is gone by then
+    auto process = new QProcess;
+    if(!cacheDirectory.isEmpty())
+    {
+        QProcessEnvironment env = QProcessEnvironment::systemEnvironment();
+        env.insert(QStringLiteral("CCACHE_DIR"), cacheDirectory);
+        process->setProcessEnvironment(env);
+    }
+
+    const auto finished = QOverload<int, QProcess::ExitStatus>::of(&QProcess::finished);
+    QObject::connect(process, finished, context, [process, callback](int exitCode, QProcess::ExitStatus exitStatus) {
+        if(exitStatus != QProcess::NormalExit || exitCode != 0)
+        {
+            qCWarning(COLCON) << "Could not read ccache statistics:" << process->errorString();
+            callback({});
+            return;
+        }
+
+        callback(parseStats(process));
+    });
+    QObject::connect(process, finished, process, &QObject::deleteLater);
+
+    // A process that failed to start does not emit finished()
+    QObject::connect(process, &QProcess::errorOccurred, context, [process, callback](QProcess::ProcessError error) {
+        if(error != QProcess::FailedToStart)
+            return;
+
+        qCWarning(COLCON) << "Could not run ccache:" << process->errorString();
+        callback({});
+    });
+    QObject::connect(process, &QProcess::errorOccurred, process, [process](QProcess::ProcessError error) {
+        if(error == QProcess::FailedToStart)
+            process->deleteLater();
+    });
+
+    // Only a few small stats files are read, but do not let a stuck cache
+    // lock hold up the build.
+    QTimer::singleShot(5000, process, [process]() {
+        process->kill();
+    });
+
+    process->start(QStringLiteral("ccache"), {QStringLiteral("--print-stats")});
+}
+
+ColconCcacheStats ColconCcacheStats::operator-(const ColconCcacheStats& before) const
+{
+    ColconCcacheStats ret;
+    ret.isValid = isValid && before.isValid;
+    ret.hits = hits - before.hits;
+    ret.misses = misses - before.misses;
+    return ret;
+}
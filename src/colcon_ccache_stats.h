@@ -0,0 +1,33 @@
+// ccache statistics
+// Author: Max Schwarz <max.schwarz@online.de>
+
+#ifndef COLCON_CCACHE_STATS_H
+#define COLCON_CCACHE_STATS_H
+
+#include <QString>
+
+#include <functional>
+
+class QObject;
+
+/**
+ * Cache hit and miss counters as reported by ccache --print-stats.
+ * Taking the difference of two snapshots yields the counts of one build.
+ */
+class ColconCcacheStats
+{
+public:
+    bool isValid = false;
+    qint64 hits = 0;
+    qint64 misses = 0;
+
+    /// Read the current counters without blocking, cacheDirectory may be
+    /// empty for the default. The callback is not invoked if context is
+    /// destroyed first.
+    static void read(const QString& cacheDirectory, QObject* context,
+        const std::function<void(const ColconCcacheStats&)>& callback);
+
+    ColconCcacheStats operator-(const ColconCcacheStats& before) const;
+};
+
+#endif
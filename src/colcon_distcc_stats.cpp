@@ -0,0 +1,100 @@
+// distcc statistics
+// Author: Max Schwarz <max.schwarz@online.de>
+
+#include "colcon_distcc_stats.h"
+
+#include <QFile>
+#include <QRegularExpression>
+#include <QSet>
+
+#include <debug.h>
+
+ColconDistccStats ColconDistccStats::readDistcc(const QString& logFile)
+{
+    ColconDistccStats stats;
+
+    QFile f(logFile);
+    if(!f.open(QFile::ReadOnly | QFile::Text))
+    {
+        qCDebug(COLCON) << "Could not open distcc log" << logFile;
+        return stats;
+    }
+
+    // distcc[1234] exec on 127.0.0.1:3632/8: /usr/bin/c++ ... -c foo.cpp
+    // distcc[1234] exec on localhost: /usr/bin/c++ ...
+    // Compilations on "localhost" did not go through a distccd, this also
+    // covers the fallback after a failed remote compilation. Going through
+    // a distccd on 127.0.0.1 counts as remote.
+    static const QRegularExpression execRe(QStringLiteral(
+        R"EOS(\bexec on (\S+?):(?:\s|$))EOS"));
+
+    while(!f.atEnd())
+    {
+        const QString line = QString::fromUtf8(f.readLine());
+
+        QRegularExpressionMatch match = execRe.match(line);
+        if(!match.hasMatch())
+            continue;
+
+        if(match.captured(1).startsWith(QLatin1String("localhost")))
+            stats.local++;
+        else
+            stats.remote++;
+    }
+
+    stats.isValid = true;
+    return stats;
+}
+
+ColconDistccStats ColconDistccStats::readIcecc(const QString& logFile)
+{
+    ColconDistccStats stats;
+
+    QFile f(logFile);
+    if(!f.open(QFile::ReadOnly | QFile::Text))
+    {
+        qCDebug(COLCON) << "Could not open icecc log" << logFile;
+        return stats;
+    }
+
+    // ICECC[1234] 12:00:00: Have to use host 192.168.1.2:10245 - Job ID: 42 ...
+    // ICECC[1234] 12:00:00: building myself, but telling localhost
+    // ICECC[1234] 12:00:00: invoking: /usr/bin/c++ ...
+    // Each client process handles one compilation. It runs locally if it
+    // invokes the compiler itself, which includes falling back after a
+    // failed remote compilation.
+    static const QRegularExpression lineRe(QStringLiteral(
+        R"EOS(^ICECC\[(\d+)\] [^:]*:[^:]*:[^:]*: (.*)$)EOS"));
+    static const QRegularExpression remoteRe(QStringLiteral(
+        R"EOS(^Have to use host (\S+?)(?::\d+)?(?:\s|$))EOS"));
+    static const QRegularExpression localRe(QStringLiteral(
+        R"EOS(^(?:invoking:|building myself|local build forced))EOS"));
+
+    QSet<QString> remote;
+    QSet<QString> local;
+    while(!f.atEnd())
+    {
+        const QString line = QString::fromUtf8(f.readLine()).trimmed();
+
+        const QRegularExpressionMatch match = lineRe.match(line);
+        if(!match.hasMatch())
+            continue;
+
+        const QString pid = match.captured(1);
+        const QString message = match.captured(2);
+
+        if(localRe.match(message).hasMatch())
+            local.insert(pid);
+        else
+        {
+            const QRegularExpressionMatch host = remoteRe.match(message);
+            if(host.hasMatch() && host.captured(1) != QLatin1String("127.0.0.1"))
+                remote.insert(pid);
+        }
+    }
+
+    stats.local = local.count();
+    stats.remote = (remote - local).count();
+    stats.isValid = true;
+    return stats;
+}
@@ -0,0 +1,25 @@
+// distcc statistics
+// Author: Max Schwarz <max.schwarz@online.de>
+
+#ifndef COLCON_DISTCC_STATS_H
+#define COLCON_DISTCC_STATS_H
+
+#include <QString>
+
+/**
+ * Counts of remote and local compilations, extracted from a verbose distcc
+ * log (DISTCC_LOG with DISTCC_VERBOSE=1) or an icecc client log
+ * (ICECC_LOGFILE with ICECC_DEBUG=debug).
+ */
+class ColconDistccStats
+{
+public:
+    bool isValid = false;
+    qint64 remote = 0;
+    qint64 local = 0;
+
+    static ColconDistccStats readDistcc(const QString& logFile);
+    static ColconDistccStats readIcecc(const QString& logFile);
+};
+
+#endif
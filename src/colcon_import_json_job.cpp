@@ -13,6 +13,7 @@
 #include <util/path.h>
 
 #include <KDirWatch>
+#include <KLocalizedString>
 #include <KShell>
 
 #include <QJsonDocument>
@@ -22,22 +23,33 @@
 #include <QFutureWatcher>
 #include <QRegularExpression>
 
+#include <algorithm>
+#include <atomic>
+
 #include <wordexp.h>
 #include <unistd.h>
 #include <getopt.h>
 
 using namespace KDevelop;
 
+struct ColconImportJsonJob::ImportState
+{
+    std::atomic<bool> abort{false};
+    std::atomic<qint64> processed{0};
+    std::atomic<qint64> total{0};
+};
+
 namespace {
 
 enum class CmdParseState
 {
     Default,
     Include,
+    FlagArgument,
     Ignore,
 };
 
-ColconFilesCompilationData importCommands(const QString& commandsFile)
+ColconFilesCompilationData importCommands(const QString& commandsFile, const KDevelop::Path& sourceDirectory, std::shared_ptr<ColconImportJsonJob::ImportState> state)
 {
     // NOTE: to get compile_commands.json, you need -DCMAKE_EXPORT_COMPILE_COMMANDS=ON
     QFile f(commandsFile);
@@ -50,8 +62,14 @@ ColconFilesCompilationData importCommands(const QString& commandsFile)
     qCDebug(COLCON) << "Found commands file" << commandsFile;
 
     ColconFilesCompilationData data;
+    const QByteArray contents = f.readAll();
+    if (state->abort)
+        return {};
+
     QJsonParseError error;
-    const QJsonDocument document = QJsonDocument::fromJson(f.readAll(), &error);
+    const QJsonDocument document = QJsonDocument::fromJson(contents, &error);
+    if (state->abort)
+        return {};
     if (error.error) {
         qCWarning(COLCON) << "Failed to parse JSON in commands file:" << error.errorString() << commandsFile;
         data.isValid = false;
@@ -65,9 +83,29 @@ ColconFilesCompilationData importCommands(const QString& commandsFile)
     const QString KEY_COMMAND = QStringLiteral("command");
     const QString KEY_DIRECTORY = QStringLiteral("directory");
     const QString KEY_FILE = QStringLiteral("file");
+    // colcon builds each package in <build root>/<package name>
+    const KDevelop::Path buildRoot{QFileInfo(commandsFile).absolutePath()};
     auto rt = ICore::self()->runtimeController()->currentRuntime();
     const auto values = document.array();
+
+    // The job polls the progress, publish it in steps of roughly one percent
+    const qint64 total = values.size();
+    const qint64 step = std::max<qint64>(1, total / 100);
+    state->total = total;
+
+    QHash<uint, ColconFile> environments;
+    QHash<KDevelop::Path, bool> existingDirectories;
+
+    qint64 processed = 0;
     for (const QJsonValue& value : values) {
+        if (state->abort) {
+            qCDebug(COLCON) << "Import of" << commandsFile << "aborted after" << processed << "of" << total << "entries";
+            return {};
+        }
+
+        if (++processed % step == 0)
+            state->processed = processed;
+
         if (!value.isObject()) {
             qCWarning(COLCON) << "JSON command file entry is not an object:" << value;
             continue;
@@ -89,6 +127,8 @@ ColconFilesCompilationData importCommands(const QString& commandsFile)
         ColconFile ret;
 
         KDevelop::Path buildPath{entry[KEY_DIRECTORY].toString()};
+        if(buildRoot.isParentOf(buildPath))
+            ret.package = buildRoot.relativePath(buildPath).section(QLatin1Char('/'), 0, 0);
 
         auto addInclude = [&](const QString& pathStr){
             if(pathStr.startsWith('/'))
@@ -117,7 +157,7 @@ ColconFilesCompilationData importCommands(const QString& commandsFile)
                     }
                     else if(word.startsWith("-U"))
                     {
-                        ret.defines.remove(word);
+                        ret.defines.remove(word.mid(2));
                     }
                     else if(word.startsWith("-I"))
                         addInclude(word.mid(2));
@@ -131,12 +171,17 @@ ColconFilesCompilationData importCommands(const QString& commandsFile)
                     else if(word == "-c")
                     {
                     }
+                    else if(word == "-MF" || word == "-MT" || word == "-MQ")
+                        state = CmdParseState::Ignore;
                     else if(word.startsWith('-'))
                     {
                         if(!ret.compileFlags.isEmpty())
                             ret.compileFlags += " ";
 
                         ret.compileFlags += word;
+
+                        if(ColconFile::flagTakesArgument(word))
+                            state = CmdParseState::FlagArgument;
                     }
 
                     break;
@@ -147,6 +192,12 @@ ColconFilesCompilationData importCommands(const QString& commandsFile)
                     state = CmdParseState::Default;
                     break;
                 }
+                case CmdParseState::FlagArgument:
+                {
+                    ret.compileFlags += " " + word;
+                    state = CmdParseState::Default;
+                    break;
+                }
                 case CmdParseState::Ignore:
                 {
                     state = CmdParseState::Default;
@@ -163,37 +214,110 @@ ColconFilesCompilationData importCommands(const QString& commandsFile)
 //         qCDebug(COLCON) << "includes:" << ret.includes;
 //         qCDebug(COLCON) << "defines:" << ret.defines;
 
+        // Drop include directories that do not exist (yet), e.g. install
+        // spaces of unbuilt packages. Each directory is checked only once.
+        for(auto it = ret.includes.begin(); it != ret.includes.end(); )
+        {
+            auto known = existingDirectories.constFind(*it);
+            if(known == existingDirectories.constEnd())
+                known = existingDirectories.insert(*it, QFileInfo(it->toLocalFile()).isDir());
+
+            if(*known)
+                ++it;
+            else
+                it = ret.includes.erase(it);
+        }
+
+        // Files with the same environment share their data
+        ret.canonicalize();
+        auto pooled = environments.constFind(ret.environmentHash);
+        if(pooled != environments.constEnd() && pooled->sameEnvironment(ret))
+        {
+            ret.includes = pooled->includes;
+            ret.frameworkDirectories = pooled->frameworkDirectories;
+            ret.compileFlags = pooled->compileFlags;
+            ret.defines = pooled->defines;
+        }
+        else
+            environments.insert(ret.environmentHash, ret);
+
         data.files[path] = ret;
     }
 
+    qCDebug(COLCON) << "Found" << environments.count() << "distinct environments for" << data.files.count() << "files";
+    for (auto it = existingDirectories.cbegin(); it != existingDirectories.cend(); ++it) {
+        if (!it.value())
+            data.missingIncludes.insert(it.key());
+    }
+    qCDebug(COLCON) << "Checked" << existingDirectories.count() << "include directories,"
+        << data.missingIncludes.count() << "do not exist";
+
+    if (state->abort)
+        return {};
+
+    data.rebuildFileForFolderMapping(&state->abort);
+    data.scanSymlinks(sourceDirectory, &state->abort);
+    if (state->abort)
+        return {};
+
     data.isValid = true;
-    data.rebuildFileForFolderMapping();
+    qCDebug(COLCON) << "Found" << data.symlinks.count() << "symlinks in" << sourceDirectory;
     return data;
 }
 
 }
 
-ColconImportJsonJob::ColconImportJsonJob(const QString& filename, QObject* parent)
+ColconImportJsonJob::ColconImportJsonJob(const QString& filename, const KDevelop::Path& sourceDirectory, QObject* parent)
     : KJob(parent)
     , m_filename{filename}
+    , m_sourceDirectory{sourceDirectory}
+    , m_state{std::make_shared<ImportState>()}
 {
+    setCapabilities(Killable);
     connect(&m_futureWatcher, &QFutureWatcher<ColconFilesCompilationData>::finished, this, &ColconImportJsonJob::importCompileCommandsJsonFinished);
+
+    m_progressTimer.setInterval(100);
+    connect(&m_progressTimer, &QTimer::timeout, this, &ColconImportJsonJob::reportProgress);
 }
 
 ColconImportJsonJob::~ColconImportJsonJob()
-{}
+{
+    // Do not wait for the worker, it owns a reference to m_state and stops
+    // at the next check.
+    m_state->abort = true;
+}
 
 void ColconImportJsonJob::start()
 {
     if (!QFileInfo::exists(m_filename))
     {
         qCWarning(COLCON) << "Could not import Colcon project, JSON file" << m_filename << "is missing.";
+        setError(FileMissingError);
+        setErrorText(i18n("Could not find %1", m_filename));
         emitResult();
         return;
     }
 
-    auto future = QtConcurrent::run(importCommands, m_filename);
+    auto future = QtConcurrent::run(importCommands, m_filename, m_sourceDirectory, m_state);
     m_futureWatcher.setFuture(future);
+    m_progressTimer.start();
+}
+
+bool ColconImportJsonJob::doKill()
+{
+    // The worker notices this at its next check. KJob emits the result
+    // for us, so importCompileCommandsJsonFinished() must not do it again.
+    m_state->abort = true;
+    m_progressTimer.stop();
+    return true;
+}
+
+void ColconImportJsonJob::reportProgress()
+{
+    if (m_state->abort)
+        return;
+
+    emitPercent(m_state->processed, m_state->total);
 }
 
 void ColconImportJsonJob::importCompileCommandsJsonFinished()
@@ -201,11 +325,18 @@ void ColconImportJsonJob::importCompileCommandsJsonFinished()
     Q_ASSERT(thread() == QThread::currentThread());
     Q_ASSERT(m_futureWatcher.isFinished());
 
+    m_progressTimer.stop();
+
+    if (m_state->abort)
+        return;
+
     auto future = m_futureWatcher.future();
     auto data = future.result();
     if (!data.isValid)
     {
         qCWarning(COLCON) << "Could not import Colcon project ('compile_commands.json' invalid)";
+        setError(ReadError);
+        setErrorText(i18n("Could not read %1", m_filename));
         emitResult();
         return;
     }
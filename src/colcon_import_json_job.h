@@ -11,6 +11,9 @@
 #include <KJob>
 
 #include <QFutureWatcher>
+#include <QTimer>
+
+#include <memory>
 
 class ColconImportJsonJob : public KJob
 {
@@ -22,19 +25,30 @@ public:
         ReadError ///< Failed to read the JSON file
     };
 
-    ColconImportJsonJob(const QString& filename, QObject* parent);
+    /// Cancellation flag and progress, shared with the worker thread. The
+    /// worker keeps it alive, so the job can go away while it is running.
+    struct ImportState;
+
+    ColconImportJsonJob(const QString& filename, const KDevelop::Path& sourceDirectory, QObject* parent);
     ~ColconImportJsonJob() override;
 
     void start() override;
 
     const ColconFilesCompilationData& data() const;
 
+protected:
+    bool doKill() override;
+
 private Q_SLOTS:
     void importCompileCommandsJsonFinished();
+    void reportProgress();
 
 private:
     QString m_filename;
+    KDevelop::Path m_sourceDirectory;
+    std::shared_ptr<ImportState> m_state;
     QFutureWatcher<ColconFilesCompilationData> m_futureWatcher;
+    QTimer m_progressTimer;
 
     ColconFilesCompilationData m_data;
 };
@@ -5,25 +5,84 @@
 
 #include "colcon_import_json_job.h"
 #include "colcon_build_job.h"
+#include "colcon_build_settings.h"
+#include "colcon_parallel_job.h"
+#include "colcon_reparse_scheduler.h"
+#include "colcon_test_job.h"
 
+#include <interfaces/context.h>
+#include <interfaces/contextmenuextension.h>
 #include <interfaces/icore.h>
+#include <interfaces/idocument.h>
+#include <interfaces/idocumentcontroller.h>
 #include <interfaces/iproject.h>
 #include <interfaces/iprojectcontroller.h>
 #include <interfaces/iruncontroller.h>
+#include <project/projectmodel.h>
+#include <serialization/indexedstring.h>
 #include <util/executecompositejob.h>
 
 #include <debug.h>
 
+#include <QAction>
 #include <QMessageBox>
+#include <QFile>
 #include <QFileInfo>
+#include <QXmlStreamReader>
 
 #include <KDirWatch>
+#include <KLocalizedString>
 #include <KPluginFactory>
 
 #include <memory>
 
 K_PLUGIN_FACTORY_WITH_JSON(kdev_colconFactory, "kdev_colcon.json", registerPlugin<ColconManager>(); )
 
+namespace {
+
+/// Kill the running background build, its packages are built with the next one
+void cancelBackgroundBuild(ColconProjectData& data)
+{
+    if(!data.backgroundBuild)
+        return;
+
+    for(const QString& package : data.backgroundBuild->packages())
+        data.pendingBuildPackages.insert(package);
+
+    data.backgroundBuild->kill();
+}
+
+/// Name of the package containing path, taken from the nearest package.xml
+/// below root. Empty if the file is not inside a package.
+QString findPackage(const KDevelop::Path& path, const KDevelop::Path& root)
+{
+    for(KDevelop::Path folder = path.parent(); folder == root || root.isParentOf(folder); folder = folder.parent())
+    {
+        QFile f(KDevelop::Path(folder, QStringLiteral("package.xml")).toLocalFile());
+        if(!f.open(QFile::ReadOnly))
+            continue;
+
+        QXmlStreamReader xml(&f);
+        if(xml.readNextStartElement() && xml.name() == QLatin1String("package"))
+        {
+            while(xml.readNextStartElement())
+            {
+                if(xml.name() == QLatin1String("name"))
+                    return xml.readElementText().trimmed();
+
+                xml.skipCurrentElement();
+            }
+        }
+
+        qCWarning(COLCON) << "Could not find the package name in" << f.fileName();
+        return {};
+    }
+
+    return {};
+}
+
+}
+
 ColconManager::ColconManager(QObject* parent, const QVariantList&)
  : KDevelop::AbstractFileManagerPlugin(QStringLiteral("kdev_colcon"), parent)
 {
@@ -33,6 +92,26 @@ ColconManager::ColconManager(QObject* parent, const QVariantList&)
         this,
             &ColconManager::projectClosing
     );
+    connect(
+        KDevelop::ICore::self()->documentController(),
+            &KDevelop::IDocumentController::documentSaved,
+        this,
+            &ColconManager::documentSaved
+    );
+
+    // Keep the symlink map up to date as the file system listing changes
+    connect(this, &AbstractFileManagerPlugin::fileAdded, this, [this](KDevelop::ProjectFileItem* item) {
+        itemAdded(item);
+    });
+    connect(this, &AbstractFileManagerPlugin::folderAdded, this, [this](KDevelop::ProjectFolderItem* item) {
+        itemAdded(item);
+    });
+    connect(this, &AbstractFileManagerPlugin::fileRemoved, this, [this](KDevelop::ProjectFileItem* item) {
+        itemRemoved(item);
+    });
+    connect(this, &AbstractFileManagerPlugin::folderRemoved, this, [this](KDevelop::ProjectFolderItem* item) {
+        itemRemoved(item);
+    });
 }
 
 ColconManager::~ColconManager()
@@ -67,12 +146,14 @@ KJob* ColconManager::createImportJob(KDevelop::ProjectFolderItem* item)
 
     const KDevelop::Path jsonPath(project->path(),  "../build/compile_commands.json");
 
-    auto job = new ColconImportJsonJob(jsonPath.toLocalFile(), this);
-    connect(job, &ColconImportJsonJob::result, this, [this, job, project]() {
+    // The import runs on a worker thread and the file listing is mostly
+    // I/O-bound, so run both at once and join before integrating the data.
+    auto imported = std::make_shared<ColconFilesCompilationData>();
+
+    auto job = new ColconImportJsonJob(jsonPath.toLocalFile(), project->path(), this);
+    connect(job, &ColconImportJsonJob::result, this, [job, imported]() {
         if (job->error() == 0)
-        {
-            integrateData(job->data(), project);
-        }
+            *imported = job->data();
     });
 
     const QList<KJob*> jobs = {
@@ -81,12 +162,27 @@ KJob* ColconManager::createImportJob(KDevelop::ProjectFolderItem* item)
     };
 
     Q_ASSERT(!jobs.contains(nullptr));
-    KDevelop::ExecuteCompositeJob* composite = new KDevelop::ExecuteCompositeJob(this, jobs);
-    composite->setAbortOnError(false);
-    return composite;
+    auto parallel = new ColconParallelJob(this, jobs);
+    parallel->setAbortOnError(false);
+
+    // The import scans the symlinks itself
+    auto it = m_projectData.find(project);
+    if(it != m_projectData.end())
+        it->second->reloadJob = parallel;
+
+    // Connected before anyone else gets hold of the job, so the data is
+    // integrated before any finished() handler triggers a reparse.
+    connect(parallel, &KJob::finished, this, [this, imported, project](KJob* job) {
+        if (job->error() == KJob::KilledJobError || !imported->isValid)
+            return;
+
+        integrateData(*imported, project);
+    });
+
+    return parallel;
 }
 
-bool ColconManager::integrateData(const ColconFilesCompilationData& data, KDevelop::IProject* project)
+bool ColconManager::integrateData(const ColconFilesCompilationData& data, KDevelop::IProject* project, QSet<KDevelop::Path>* changedFiles)
 {
     auto it = m_projectData.find(project);
 
@@ -101,23 +197,15 @@ bool ColconManager::integrateData(const ColconFilesCompilationData& data, KDevel
         projectData->jsonWatcher = new KDirWatch();
         projectData->jsonWatcher->addFile(jsonPath.toLocalFile());
 
-        connect(projectData->jsonWatcher, &KDirWatch::dirty, [this, jsonPath, project](){
+        connect(projectData->jsonWatcher, &KDirWatch::dirty, this, [this, project](){
             qCWarning(COLCON) << "DirWatch says JSON has changed!";
-            auto job = new ColconImportJsonJob(jsonPath.toLocalFile(), this);
-            connect(job, &ColconImportJsonJob::result, this, [this, job, project]() {
-                if(job->error() == 0)
-                {
-                    if(integrateData(job->data(), project))
-                    {
-                        qCDebug(COLCON) << "Triggering reparse...";
-                        emit KDevelop::ICore::self()->projectController()->projectConfigurationChanged(project);
-                        KDevelop::ICore::self()->projectController()->reparseProject(project);
-                    }
-                }
-            });
 
-            project->setReloadJob(job);
-            KDevelop::ICore::self()->runController()->registerJob(job);
+            auto it = m_projectData.find(project);
+            if(it == m_projectData.end())
+                return;
+
+            it->second->jsonChanges++;
+            reimport(project);
         });
 
         m_projectData[project] = std::move(projectData);
@@ -129,6 +217,9 @@ bool ColconManager::integrateData(const ColconFilesCompilationData& data, KDevel
         auto& projectData = it->second;
         auto& currentFiles = projectData->compilationData.files;
 
+        projectData->compilationData.symlinks = data.symlinks;
+        projectData->compilationData.missingIncludes = data.missingIncludes;
+
         bool changed = false;
 
         QHashIterator<KDevelop::Path, ColconFile> fileIt(data.files);
@@ -141,6 +232,8 @@ bool ColconManager::integrateData(const ColconFilesCompilationData& data, KDevel
             {
                 currentFiles[fileIt.key()] = fileIt.value();
                 changed = true;
+                if(changedFiles)
+                    changedFiles->insert(fileIt.key());
             }
             else
             {
@@ -149,6 +242,8 @@ bool ColconManager::integrateData(const ColconFilesCompilationData& data, KDevel
                 {
                     currentValue = fileIt.value();
                     changed = true;
+                    if(changedFiles)
+                        changedFiles->insert(fileIt.key());
                 }
             }
         }
@@ -163,26 +258,72 @@ bool ColconManager::integrateData(const ColconFilesCompilationData& data, KDevel
     }
 }
 
+void ColconManager::reimport(KDevelop::IProject* project)
+{
+    const KDevelop::Path jsonPath(project->path(),  "../build/compile_commands.json");
+
+    auto it = m_projectData.find(project);
+    if(it == m_projectData.end())
+        return;
+
+    // A running import works on outdated data, stop it right away
+    auto& projectData = it->second;
+    if(projectData->importJob)
+    {
+        qCDebug(COLCON) << "Killing stale import job";
+        projectData->importJob->kill();
+    }
+
+    auto job = new ColconImportJsonJob(jsonPath.toLocalFile(), project->path(), this);
+    projectData->importJob = job;
+    connect(job, &ColconImportJsonJob::result, this, [this, job, project]() {
+        // A missing or unreadable JSON would wipe the current data
+        if(job->error() == 0 && job->data().isValid)
+        {
+            QSet<KDevelop::Path> changedFiles;
+            if(integrateData(job->data(), project, &changedFiles))
+            {
+                qCDebug(COLCON) << "Triggering reparse...";
+                emit KDevelop::ICore::self()->projectController()->projectConfigurationChanged(project);
+
+                auto& projectData = m_projectData.at(project);
+                ColconReparseScheduler::schedule(
+                    project, projectData->compilationData,
+                    changedFiles, projectData->builtPackages
+                );
+                projectData->builtPackages.clear();
+            }
+        }
+    });
+
+    project->setReloadJob(job);
+    KDevelop::ICore::self()->runController()->registerJob(job);
+}
+
 ColconFile ColconManager::fileInformation(KDevelop::ProjectBaseItem* item) const
 {
-    auto it = m_projectData.find(item->project());
+    return fileInformation(item->project(), item->path(), item->folder());
+}
+
+ColconFile ColconManager::fileInformation(KDevelop::IProject* project, const KDevelop::Path& itemPath, bool isFolder) const
+{
+    auto it = m_projectData.find(project);
     if(it == m_projectData.end())
         return {};
 
     const auto& data = it->second->compilationData;
 
-    auto toCanonicalPath = [](const KDevelop::Path &path) -> KDevelop::Path {
-        // if the path contains a symlink, then we will not find it in the lookup table
-        // as that only only stores canonicalized paths. Thus, we fallback to
-        // to the canonicalized path and see if that brings up any matches
-        const auto localPath = path.toLocalFile();
-        const auto canonicalPath = QFileInfo(localPath).canonicalFilePath();
-        return (localPath == canonicalPath) ? path : KDevelop::Path(canonicalPath);
+    // if the path contains a symlink, then we will not find it in the lookup table
+    // as that only only stores canonicalized paths. Thus, we fallback to
+    // to the canonicalized path and see if that brings up any matches.
+    // The symlinks were resolved during import, so this does not touch the filesystem.
+    auto toCanonicalPath = [&data](const KDevelop::Path &path) -> KDevelop::Path {
+        return data.resolveSymlinks(path);
     };
 
-    auto path = item->path();
+    auto path = itemPath;
 
-    if (!item->folder()) {
+    if (!isFolder) {
         // try to look for file meta data directly
         auto it = data.files.find(path);
         if (it == data.files.end()) {
@@ -218,10 +359,43 @@ ColconFile ColconManager::fileInformation(KDevelop::ProjectBaseItem* item) const
         path = path.parent();
     }
 
-    qCDebug(COLCON) << "no information found for" << item->path();
+    qCDebug(COLCON) << "no information found for" << itemPath;
     return {};
 }
 
+void ColconManager::itemAdded(KDevelop::ProjectBaseItem* item)
+{
+    auto it = m_projectData.find(item->project());
+    if(it == m_projectData.end() || it->second->reloadJob)
+        return;
+
+    const QFileInfo info(item->path().toLocalFile());
+    if(!info.isSymLink())
+        return;
+
+    const QString target = info.canonicalFilePath();
+    if(!target.isEmpty())
+        it->second->compilationData.symlinks.insert(item->path(), KDevelop::Path(target));
+}
+
+void ColconManager::itemRemoved(KDevelop::ProjectBaseItem* item)
+{
+    auto it = m_projectData.find(item->project());
+    if(it == m_projectData.end() || it->second->reloadJob)
+        return;
+
+    // A removed folder takes the symlinks below it along
+    const KDevelop::Path path = item->path();
+    auto& symlinks = it->second->compilationData.symlinks;
+    for(auto symlink = symlinks.begin(); symlink != symlinks.end(); )
+    {
+        if(symlink.key() == path || path.isParentOf(symlink.key()))
+            symlink = symlinks.erase(symlink);
+        else
+            ++symlink;
+    }
+}
+
 KDevelop::Path::List ColconManager::includeDirectories(KDevelop::ProjectBaseItem *item) const
 {
     return fileInformation(item).includes;
@@ -305,12 +479,29 @@ bool ColconManager::reload(KDevelop::ProjectFolderItem* folder)
     KDevelop::ICore::self()->runController()->registerJob( job );
     if(folder == project->projectItem())
     {
-        connect(job, &KJob::finished, this, [project](KJob* job) {
+        connect(job, &KJob::finished, this, [this, project](KJob* job) {
             if (job->error())
                 return;
 
+            auto it = m_projectData.find(project);
+            if(it == m_projectData.end())
+                return;
+
             emit KDevelop::ICore::self()->projectController()->projectConfigurationChanged(project);
-            KDevelop::ICore::self()->projectController()->reparseProject(project);
+
+            // Everything is reparsed, but the documents the developer looks
+            // at and the packages just built come first
+            QSet<KDevelop::Path> files;
+            const auto fileSet = project->fileSet();
+            for(const KDevelop::IndexedString& file : fileSet)
+                files.insert(KDevelop::Path(file.toUrl()));
+
+            auto& projectData = it->second;
+            ColconReparseScheduler::schedule(
+                project, projectData->compilationData,
+                files, projectData->builtPackages
+            );
+            projectData->builtPackages.clear();
         });
     }
 
@@ -319,12 +510,219 @@ bool ColconManager::reload(KDevelop::ProjectFolderItem* folder)
 
 void ColconManager::projectClosing(KDevelop::IProject* project)
 {
-    m_projectData.erase(project);
+    auto it = m_projectData.find(project);
+    if(it == m_projectData.end())
+        return;
+
+    // Its result would bring the project data back
+    if(it->second->importJob)
+        it->second->importJob->kill();
+
+    if(it->second->backgroundBuild)
+        it->second->backgroundBuild->kill();
+
+    m_projectData.erase(it);
 }
 
 KJob* ColconManager::build(KDevelop::ProjectBaseItem* item)
 {
-    return new ColconBuildJob(item->project(), this);
+    return createBuildJob(item->project(), {}, ColconBuildJob::Mode::Foreground);
+}
+
+ColconBuildJob* ColconManager::createBuildJob(KDevelop::IProject* project, const QStringList& packages, ColconBuildJob::Mode mode, ColconBuildJob::Selection selection)
+{
+    auto job = new ColconBuildJob(project, packages, mode, selection, this);
+
+    int jsonChanges = 0;
+    auto it = m_projectData.find(project);
+    if(it != m_projectData.end())
+    {
+        auto& projectData = it->second;
+        jsonChanges = projectData->jsonChanges;
+
+        // A build started by hand takes precedence over build-on-save
+        if(mode == ColconBuildJob::Mode::Foreground)
+            cancelBackgroundBuild(*projectData);
+
+        projectData->buildJobs << job;
+    }
+
+    connect(job, &KJob::finished, this, [this, job, project]() {
+        auto it = m_projectData.find(project);
+        if(it == m_projectData.end())
+            return;
+
+        auto& projectData = it->second;
+        projectData->buildJobs.removeAll(job);
+
+        // Saves that came in while this build was running
+        if(!projectData->pendingBuildPackages.isEmpty() && projectData->buildOnSaveTimer)
+            projectData->buildOnSaveTimer->start();
+    });
+
+    // Remember what was built, so the reparse after the following reimport
+    // can prioritize these packages. The watcher may reimport while the
+    // build is still running, so publish each package right away.
+    connect(job, &ColconBuildJob::packageBuilt, this, [this, project](const QString& package) {
+        auto it = m_projectData.find(project);
+        if(it != m_projectData.end())
+            it->second->builtPackages.insert(package);
+    });
+
+    connect(job, &ColconBuildJob::result, this, [this, job, project, jsonChanges]() {
+        auto it = m_projectData.find(project);
+        if(it == m_projectData.end())
+            return;
+
+        // colcon rewrites compile_commands.json while configuring, which the
+        // watcher already reimports. Otherwise only pruned include
+        // directories in the install space may have appeared.
+        auto& projectData = it->second;
+        if(job->error() != KJob::KilledJobError
+            && projectData->jsonChanges == jsonChanges
+            && projectData->compilationData.missingIncludesAppeared())
+        {
+            reimport(project);
+            return;
+        }
+
+        // A running reimport still needs the packages, otherwise there is
+        // no reparse left to prioritize
+        if(!projectData->importJob)
+            projectData->builtPackages.clear();
+    });
+
+    return job;
+}
+
+KJob* ColconManager::testModified(KDevelop::IProject* project)
+{
+    auto it = m_projectData.find(project);
+    if(it == m_projectData.end() || it->second->modifiedPackages.isEmpty())
+        return nullptr;
+
+    const QStringList packages = it->second->modifiedPackages.values();
+
+    // Tests have to run against up to date binaries, so build everything
+    // that is going to be tested first. A failed build skips the tests.
+    KJob* build = createBuildJob(project, packages, ColconBuildJob::Mode::Foreground, ColconBuildJob::Selection::PackagesAbove);
+
+    auto test = new ColconTestJob(project, packages, this);
+    connect(test, &ColconTestJob::result, this, [this, test, project]() {
+        if(test->error() != 0)
+            return;
+
+        auto it = m_projectData.find(project);
+        if(it == m_projectData.end())
+            return;
+
+        for(const QString& package : test->packages())
+            it->second->modifiedPackages.remove(package);
+    });
+
+    return new KDevelop::ExecuteCompositeJob(this, {build, test});
+}
+
+KDevelop::ContextMenuExtension ColconManager::contextMenuExtension(KDevelop::Context* context, QWidget* parent)
+{
+    KDevelop::ContextMenuExtension ext = AbstractFileManagerPlugin::contextMenuExtension(context, parent);
+
+    if(context->type() != KDevelop::Context::ProjectItemContext)
+        return ext;
+
+    const auto items = static_cast<KDevelop::ProjectItemContext*>(context)->items();
+    if(items.isEmpty())
+        return ext;
+
+    KDevelop::IProject* project = items.first()->project();
+    if(m_projectData.find(project) == m_projectData.end())
+        return ext;
+
+    auto action = new QAction(QIcon::fromTheme(QStringLiteral("system-run")), i18n("Test Modified Packages"), parent);
+    connect(action, &QAction::triggered, this, [this, project]() {
+        KJob* job = testModified(project);
+        if(!job)
+        {
+            QMessageBox::information(nullptr, "Colcon Manager", "No packages were modified since their last successful test.");
+            return;
+        }
+
+        KDevelop::ICore::self()->runController()->registerJob(job);
+    });
+    ext.addAction(KDevelop::ContextMenuExtension::BuildGroup, action);
+
+    return ext;
+}
+
+void ColconManager::documentSaved(KDevelop::IDocument* document)
+{
+    const KDevelop::Path path{document->url()};
+
+    KDevelop::IProject* project = KDevelop::ICore::self()->projectController()->findProjectForUrl(document->url());
+    if(!project)
+        return;
+
+    auto it = m_projectData.find(project);
+    if(it == m_projectData.end())
+        return;
+
+    // The compile data does not cover e.g. Python packages, and its folder
+    // fallback would attribute such files to an unrelated package.
+    const QString package = findPackage(path, project->path());
+    if(package.isEmpty())
+        return;
+
+    it->second->modifiedPackages.insert(package);
+
+    const ColconBuildSettings settings = ColconBuildSettings::fromProject(project);
+    if(!settings.buildOnSave)
+        return;
+
+    auto& projectData = it->second;
+    projectData->pendingBuildPackages.insert(package);
+
+    // The running build is outdated now
+    cancelBackgroundBuild(*projectData);
+
+    if(!projectData->buildOnSaveTimer)
+    {
+        projectData->buildOnSaveTimer = std::make_unique<QTimer>();
+        projectData->buildOnSaveTimer->setSingleShot(true);
+        connect(projectData->buildOnSaveTimer.get(), &QTimer::timeout, this, [this, project]() {
+            startBackgroundBuild(project);
+        });
+    }
+
+    // Restarting the timer debounces a series of saves into one build
+    projectData->buildOnSaveTimer->start(settings.buildOnSaveDelay);
+}
+
+void ColconManager::startBackgroundBuild(KDevelop::IProject* project)
+{
+    auto it = m_projectData.find(project);
+    if(it == m_projectData.end())
+        return;
+
+    auto& projectData = it->second;
+    if(projectData->pendingBuildPackages.isEmpty())
+        return;
+
+    // Keep the packages queued until the running build finished
+    projectData->buildJobs.removeAll(nullptr);
+    if(!projectData->buildJobs.isEmpty())
+    {
+        qCDebug(COLCON) << "Not building in the background while another build is running";
+        return;
+    }
+
+    const QStringList packages = projectData->pendingBuildPackages.values();
+    projectData->pendingBuildPackages.clear();
+
+    qCDebug(COLCON) << "Building" << packages << "in the background";
+
+    ColconBuildJob* job = createBuildJob(project, packages, ColconBuildJob::Mode::Background);
+    projectData->backgroundBuild = job;
+    KDevelop::ICore::self()->runController()->registerJob(job);
 }
 
 KJob* ColconManager::install(KDevelop::ProjectBaseItem* item, const QUrl& specificPrefix)
@@ -4,6 +4,8 @@
 #ifndef KDEV_COLCON_H
 #define KDEV_COLCON_H
 
+#include "colcon_build_job.h"
+
 #include <project/abstractfilemanagerplugin.h>
 #include <project/interfaces/iprojectfilemanager.h>
 #include <project/interfaces/ibuildsystemmanager.h>
@@ -11,8 +13,17 @@
 
 #include <project/projectmodel.h>
 
+#include <interfaces/contextmenuextension.h>
+
+#include <QSet>
+
 #include <memory>
 
+namespace KDevelop
+{
+    class IDocument;
+}
+
 class ColconProjectData;
 struct ColconFile;
 class ColconFilesCompilationData;
@@ -70,12 +81,26 @@ public:
     KJob* install(KDevelop::ProjectBaseItem* item, const QUrl& specificPrefix) override;
     KJob* clean(KDevelop::ProjectBaseItem* item) override;
 
+    KDevelop::ContextMenuExtension contextMenuExtension(KDevelop::Context* context, QWidget* parent) override;
+
+    /// Test the packages with files saved since their last successful test
+    KJob* testModified(KDevelop::IProject* project);
+
 private Q_SLOTS:
     void projectClosing(KDevelop::IProject*);
+    void documentSaved(KDevelop::IDocument* document);
+    void startBackgroundBuild(KDevelop::IProject* project);
 
 private:
-    bool integrateData(const ColconFilesCompilationData& data, KDevelop::IProject* project);
+    ColconBuildJob* createBuildJob(KDevelop::IProject* project, const QStringList& packages, ColconBuildJob::Mode mode,
+        ColconBuildJob::Selection selection = ColconBuildJob::Selection::Packages);
+    void reimport(KDevelop::IProject* project);
+    bool integrateData(const ColconFilesCompilationData& data, KDevelop::IProject* project, QSet<KDevelop::Path>* changedFiles = nullptr);
     ColconFile fileInformation(KDevelop::ProjectBaseItem* item) const;
+    ColconFile fileInformation(KDevelop::IProject* project, const KDevelop::Path& path, bool isFolder) const;
+
+    void itemAdded(KDevelop::ProjectBaseItem* item);
+    void itemRemoved(KDevelop::ProjectBaseItem* item);
 
     std::unordered_map<KDevelop::IProject*, std::unique_ptr<ColconProjectData>> m_projectData;
 };
@@ -0,0 +1,126 @@
+// Composite job running its subjobs concurrently
+// Author: Max Schwarz <max.schwarz@online.de>
+
+#include "colcon_parallel_job.h"
+
+#include <kcoreaddons_version.h>
+
+#include <debug.h>
+
+ColconParallelJob::ColconParallelJob(QObject* parent, const QList<KJob*>& jobs)
+ : KCompositeJob{parent}
+{
+    setCapabilities(Killable);
+
+    for(KJob* job : jobs)
+    {
+        if(!job)
+        {
+            qCWarning(COLCON) << "Added null job to ColconParallelJob";
+            continue;
+        }
+
+        addSubjob(job);
+        m_percent[job] = 0;
+#if KCOREADDONS_VERSION >= QT_VERSION_CHECK(5, 80, 0)
+        connect(job, &KJob::percentChanged, this, &ColconParallelJob::subjobPercent);
+#else
+        connect(job, &KJob::percent, this, &ColconParallelJob::subjobPercent);
+#endif
+    }
+}
+
+ColconParallelJob::~ColconParallelJob()
+{
+}
+
+void ColconParallelJob::setAbortOnError(bool abort)
+{
+    m_abortOnError = abort;
+}
+
+void ColconParallelJob::start()
+{
+    if(!hasSubjobs())
+    {
+        emitResult();
+        return;
+    }
+
+    // Subjobs may finish synchronously inside start(), which removes them
+    // from the list - so iterate over a copy.
+    const QList<KJob*> jobs = subjobs();
+    for(KJob* job : jobs)
+    {
+        if(subjobs().contains(job))
+            job->start();
+    }
+}
+
+bool ColconParallelJob::doKill()
+{
+    m_killing = true;
+
+    const QList<KJob*> jobs = subjobs();
+    for(KJob* job : jobs)
+    {
+        if(!job->kill(KJob::Quietly))
+        {
+            qCWarning(COLCON) << "Could not kill subjob" << job;
+            m_killing = false;
+            return false;
+        }
+        removeSubjob(job);
+    }
+
+    return true;
+}
+
+void ColconParallelJob::slotResult(KJob* job)
+{
+    if(m_killing)
+        return;
+
+    if(job->error() && !error())
+    {
+        setError(job->error());
+        setErrorText(job->errorText());
+    }
+
+    removeSubjob(job);
+    m_percent[job] = 100;
+    updatePercent();
+
+    if(job->error() && m_abortOnError)
+    {
+        const QList<KJob*> jobs = subjobs();
+        for(KJob* other : jobs)
+        {
+            other->kill(KJob::Quietly);
+            removeSubjob(other);
+        }
+    }
+
+    if(!hasSubjobs())
+        emitResult();
+}
+
+void ColconParallelJob::subjobPercent(KJob* job, unsigned long percent)
+{
+    m_percent[job] = percent;
+    updatePercent();
+}
+
+void ColconParallelJob::updatePercent()
+{
+    if(m_percent.isEmpty())
+        return;
+
+    unsigned long sum = 0;
+    for(unsigned long p : qAsConst(m_percent))
+        sum += p;
+
+    emitPercent(sum, 100 * m_percent.count());
+}
+
+#include "moc_colcon_parallel_job.cpp"
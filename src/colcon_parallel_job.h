@@ -0,0 +1,45 @@
+// Composite job running its subjobs concurrently
+// Author: Max Schwarz <max.schwarz@online.de>
+
+#ifndef COLCON_PARALLEL_JOB_H
+#define COLCON_PARALLEL_JOB_H
+
+#include <KCompositeJob>
+
+#include <QHash>
+
+/**
+ * Like KDevelop::ExecuteCompositeJob, but starts all subjobs at once and
+ * finishes when the last of them is done. Progress is the average over
+ * all subjobs, where finished jobs count as complete.
+ */
+class ColconParallelJob : public KCompositeJob
+{
+Q_OBJECT
+public:
+    ColconParallelJob(QObject* parent, const QList<KJob*>& jobs);
+    ~ColconParallelJob() override;
+
+    void start() override;
+
+    /// If set, the first failing subjob kills the remaining ones
+    void setAbortOnError(bool abort);
+
+protected:
+    bool doKill() override;
+
+protected Q_SLOTS:
+    void slotResult(KJob* job) override;
+
+private Q_SLOTS:
+    void subjobPercent(KJob* job, unsigned long percent);
+
+private:
+    void updatePercent();
+
+    bool m_abortOnError = true;
+    bool m_killing = false;
+    QHash<KJob*, unsigned long> m_percent;
+};
+
+#endif
@@ -3,21 +3,186 @@
 
 #include <KDirWatch>
 
-bool operator==(const ColconFile& a, const ColconFile& b)
+#include <QDirIterator>
+#include <QFileInfo>
+#include <QMap>
+
+#include <algorithm>
+
+namespace {
+
+bool isIrrelevantFlag(const QString& flag)
+{
+    // Warnings and diagnostics formatting
+    if (flag.startsWith(QLatin1String("-W")))
+        return !flag.startsWith(QLatin1String("-Wp,")); // preprocessor options do matter
+    if (flag == QLatin1String("-w") || flag.startsWith(QLatin1String("-pedantic")))
+        return true;
+    if (flag.startsWith(QLatin1String("-fdiagnostics-")) || flag.endsWith(QLatin1String("color-diagnostics")))
+        return true;
+
+    // Dependency file generation
+    if (flag.startsWith(QLatin1String("-M")))
+        return true;
+
+    // Debug info
+    if (flag.startsWith(QLatin1String("-g")))
+        return true;
+
+    return false;
+}
+
+/// Flags with the same key override each other, the last one wins. Returns
+/// an empty key for all other flags, which accumulate (-fsanitize=,
+/// -fmacro-prefix-map=, ...) and have to stay in order.
+QString overrideKey(const QString& flag)
+{
+    if (flag.startsWith(QLatin1String("-O")))
+        return QStringLiteral("-O");
+    if (flag.startsWith(QLatin1String("-std=")))
+        return QStringLiteral("-std=");
+    if (flag.startsWith(QLatin1String("-march=")))
+        return QStringLiteral("-march=");
+    if (flag == QLatin1String("-m16") || flag == QLatin1String("-m32")
+        || flag == QLatin1String("-m64") || flag == QLatin1String("-mx32"))
+        return QStringLiteral("-m<abi>");
+
+    if (flag.contains(QLatin1Char('=')))
+        return {};
+
+    if (flag.startsWith(QLatin1String("-fno-")))
+        return QStringLiteral("-f") + flag.mid(5);
+    if (flag.startsWith(QLatin1String("-mno-")))
+        return QStringLiteral("-m") + flag.mid(5);
+    if (flag.startsWith(QLatin1String("-f")) || flag.startsWith(QLatin1String("-m")))
+        return flag;
+
+    return {};
+}
+
+/// Substitute the deepest symlinked ancestor of path (or the path itself)
+KDevelop::Path resolveDeepestSymlink(const QHash<KDevelop::Path, KDevelop::Path>& symlinks, const KDevelop::Path& path)
+{
+    for (auto folder = path; ; folder = folder.parent()) {
+        auto it = symlinks.constFind(folder);
+        if (it != symlinks.constEnd()) {
+            if (folder == path)
+                return it.value();
+            return KDevelop::Path(it.value(), folder.relativePath(path));
+        }
+        if (!folder.hasParent())
+            break;
+    }
+
+    return path;
+}
+
+template<class T>
+void removeDuplicates(QVector<T>& list)
+{
+    QSet<T> seen;
+    for (auto it = list.begin(); it != list.end(); ) {
+        if (seen.contains(*it)) {
+            it = list.erase(it);
+        } else {
+            seen.insert(*it);
+            ++it;
+        }
+    }
+}
+
+}
+
+void ColconFile::canonicalize()
+{
+    // Include order matters, so keep the first occurrence of each directory.
+    // This also drops -isystem duplicates of -I directories.
+    removeDuplicates(includes);
+    removeDuplicates(frameworkDirectories);
+
+    // Flags that override each other do not depend on their position, so
+    // the last one of each kind is emitted in key order. Everything else
+    // may accumulate and keeps its original order behind them.
+    const QStringList flags = compileFlags.split(QLatin1Char(' '), Qt::SkipEmptyParts);
+    QStringList kept;
+    QMap<QString, QString> overridden; // override key -> last flag
+    for (int i = 0; i < flags.size(); ++i) {
+        const QString& flag = flags[i];
+
+        // Keep pairs like -Xclang <arg> together and untouched
+        if (flagTakesArgument(flag) && i + 1 < flags.size()) {
+            kept << flag << flags[++i];
+            continue;
+        }
+
+        if (isIrrelevantFlag(flag))
+            continue;
+
+        const QString key = overrideKey(flag);
+        if (!key.isEmpty())
+            overridden[key] = flag;
+        else
+            kept << flag;
+    }
+
+    compileFlags = (overridden.values() + kept).join(QLatin1Char(' '));
+
+    // Use a fixed seed, qHash's default seed changes between runs
+    uint hash = qHash(compileFlags, 0);
+    hash = hash * 31 + qHash(language, 0);
+    for (const auto& include : qAsConst(includes))
+        hash = hash * 31 + qHash(include.pathOrUrl(), 0);
+    for (const auto& dir : qAsConst(frameworkDirectories))
+        hash = hash * 31 + qHash(dir.pathOrUrl(), 0);
+
+    QStringList defineKeys = defines.keys();
+    std::sort(defineKeys.begin(), defineKeys.end());
+    for (const QString& key : qAsConst(defineKeys))
+        hash = hash * 31 + (qHash(key, 0) ^ qHash(defines[key], 0));
+
+    environmentHash = hash;
+}
+
+bool ColconFile::flagTakesArgument(const QString& flag)
+{
+    static const QStringList flags = {
+        QStringLiteral("-Xclang"),
+        QStringLiteral("-Xpreprocessor"),
+        QStringLiteral("-include"),
+        QStringLiteral("-imacros"),
+        QStringLiteral("-iquote"),
+        QStringLiteral("-idirafter"),
+        QStringLiteral("-isysroot"),
+        QStringLiteral("-target"),
+        QStringLiteral("-x"),
+    };
+
+    return flags.contains(flag);
+}
+
+bool ColconFile::sameEnvironment(const ColconFile& other) const
 {
     return
-        a.compileFlags == b.compileFlags
-        && a.defines == b.defines
-        && a.frameworkDirectories == b.frameworkDirectories
-        && a.includes == b.includes
-        && a.language == b.language;
+        environmentHash == other.environmentHash
+        && compileFlags == other.compileFlags
+        && defines == other.defines
+        && frameworkDirectories == other.frameworkDirectories
+        && includes == other.includes
+        && language == other.language;
+}
+
+bool operator==(const ColconFile& a, const ColconFile& b)
+{
+    return a.sameEnvironment(b) && a.package == b.package;
 }
 
-void ColconFilesCompilationData::rebuildFileForFolderMapping()
+void ColconFilesCompilationData::rebuildFileForFolderMapping(const std::atomic<bool>* abort)
 {
     fileForFolder.clear();
     // iterate over files and add all direct folders
     for (auto it = files.constBegin(), end = files.constEnd(); it != end; ++it) {
+        if (abort && *abort)
+            return;
         const auto file = it.key();
         const auto folder = file.parent();
         if (fileForFolder.contains(folder))
@@ -27,6 +192,8 @@ void ColconFilesCompilationData::rebuildFileForFolderMapping()
     // now also add the parents of these folders
     const auto copy = fileForFolder;
     for (auto it = copy.begin(), end = copy.end(); it != end; ++it) {
+        if (abort && *abort)
+            return;
         auto folder = it.key();
         while (folder.hasParent()) {
             folder = folder.parent();
@@ -38,4 +205,62 @@ void ColconFilesCompilationData::rebuildFileForFolderMapping()
     }
 }
 
-ColconProjectData::~ColconProjectData() = default;
+void ColconFilesCompilationData::scanSymlinks(const KDevelop::Path& root, const std::atomic<bool>* abort)
+{
+    symlinks.clear();
+
+    // The workspace itself may sit below a symlinked directory (~/ws -> /data/ws),
+    // while compile_commands.json contains canonical paths.
+    const QString canonicalRoot = QFileInfo(root.toLocalFile()).canonicalFilePath();
+    if (!canonicalRoot.isEmpty() && KDevelop::Path(canonicalRoot) != root)
+        symlinks.insert(root, KDevelop::Path(canonicalRoot));
+
+    // QDirIterator does not descend into symlinked directories by default,
+    // and its QFileInfo caches the lstat() result.
+    QDirIterator it(root.toLocalFile(), QDir::AllEntries | QDir::NoDotAndDotDot | QDir::System, QDirIterator::Subdirectories);
+    while (it.hasNext()) {
+        if (abort && *abort)
+            return;
+
+        it.next();
+        const QFileInfo info = it.fileInfo();
+        if (!info.isSymLink())
+            continue;
+
+        const QString target = info.canonicalFilePath();
+        if (target.isEmpty()) // dangling link
+            continue;
+
+        symlinks.insert(KDevelop::Path(info.absoluteFilePath()), KDevelop::Path(target));
+    }
+}
+
+KDevelop::Path ColconFilesCompilationData::resolveSymlinks(const KDevelop::Path& path) const
+{
+    if (symlinks.isEmpty())
+        return path;
+
+    // The substituted path may contain further symlinks, so repeat until
+    // nothing applies. The limit guards against cycles, like MAXSYMLINKS.
+    auto resolved = path;
+    for (int i = 0; i < 40; ++i) {
+        const auto next = resolveDeepestSymlink(symlinks, resolved);
+        if (next == resolved)
+            break;
+        resolved = next;
+    }
+
+    return resolved;
+}
+
+bool ColconFilesCompilationData::missingIncludesAppeared() const
+{
+    return std::any_of(missingIncludes.cbegin(), missingIncludes.cend(), [](const KDevelop::Path& dir) {
+        return QFileInfo(dir.toLocalFile()).isDir();
+    });
+}
+
+ColconProjectData::~ColconProjectData()
+{
+    delete jsonWatcher;
+}
@@ -9,8 +9,15 @@
 #include <util/path.h>
 #include <QDebug>
 #include <QPointer>
+#include <QSet>
+#include <QTimer>
+
+#include <atomic>
+#include <memory>
 
 class KDirWatch;
+class KJob;
+class ColconBuildJob;
 
 /**
  * Contains the required information to compile it properly
@@ -23,12 +30,30 @@ public:
     QString compileFlags;
     QString language;
     QHash<QString, QString> defines;
+    /// Name of the colcon package the file belongs to
+    QString package;
+    /// Hash over the parse environment (everything but the package),
+    /// stable across sessions. Valid after canonicalize().
+    uint environmentHash = 0;
 
     bool isEmpty() const
     {
         return includes.isEmpty() && frameworkDirectories.isEmpty()
             && compileFlags.isEmpty() && defines.isEmpty();
     }
+
+    /// Bring the file into a canonical form, so that files with the same
+    /// effective flags get the same parse environment: drops flags without
+    /// influence on parsing, removes duplicate include directories and
+    /// keeps only the last of flags that override each other (-O, -std=,
+    /// -march=, -m32/-m64, -f[no-]x, -m[no-]x), sorted.
+    void canonicalize();
+
+    /// Whether flag takes its argument as the next word (e.g. -Xclang)
+    static bool flagTakesArgument(const QString& flag);
+
+    /// Whether both files are parsed in the same environment
+    bool sameEnvironment(const ColconFile& other) const;
 };
 Q_DECLARE_TYPEINFO(ColconFile, Q_MOVABLE_TYPE);
 
@@ -52,7 +77,23 @@ public:
     /// this greatly speeds up fallback searching for information on untracked files
     /// based on their folder path
     QHash<KDevelop::Path, KDevelop::Path> fileForFolder;
-    void rebuildFileForFolderMapping();
+    /// stops early if abort is set, leaving the mapping incomplete
+    void rebuildFileForFolderMapping(const std::atomic<bool>* abort = nullptr);
+
+    /// symlinks below the source directory, mapped to their canonical target,
+    /// plus the source directory itself if its path is not canonical
+    /// this allows resolving symlinked paths without touching the filesystem
+    QHash<KDevelop::Path, KDevelop::Path> symlinks;
+    void scanSymlinks(const KDevelop::Path& root, const std::atomic<bool>* abort = nullptr);
+
+    /// translate a path through the symlink map, returns path if no symlink applies
+    KDevelop::Path resolveSymlinks(const KDevelop::Path& path) const;
+
+    /// include directories dropped at import because they did not exist
+    QSet<KDevelop::Path> missingIncludes;
+
+    /// whether any of missingIncludes exists by now, touches the filesystem
+    bool missingIncludesAppeared() const;
 };
 
 class ColconProjectData
@@ -60,15 +101,39 @@ class ColconProjectData
 public:
     ColconProjectData() = default;
     ColconProjectData(const ColconProjectData&) = delete;
-    ColconProjectData(ColconProjectData&&) = default;
     ~ColconProjectData();
 
     ColconProjectData& operator=(const ColconProjectData&) = delete;
-    ColconProjectData& operator=(ColconProjectData&&) = default;
 
     ColconFilesCompilationData compilationData;
 
+    /// Owned, deleted together with the project data
     QPointer<KDirWatch> jsonWatcher;
+
+    /// Number of times jsonWatcher reported a change
+    int jsonChanges = 0;
+
+    /// Running reimport, if any
+    QPointer<KJob> importJob;
+
+    /// Running reload of the project, which rescans the symlinks
+    QPointer<KJob> reloadJob;
+
+    /// Packages built by the last ColconBuildJob
+    QSet<QString> builtPackages;
+
+    /// Packages with files saved since they were last tested successfully
+    QSet<QString> modifiedPackages;
+
+    /// Build-on-save: packages waiting for the debounce timer, and the
+    /// background build that is currently running
+    QSet<QString> pendingBuildPackages;
+    std::unique_ptr<QTimer> buildOnSaveTimer;
+    QPointer<ColconBuildJob> backgroundBuild;
+
+    /// Build jobs of this project that did not finish yet. colcon must not
+    /// run twice in the same workspace.
+    QList<QPointer<ColconBuildJob>> buildJobs;
 };
 
 #endif
@@ -0,0 +1,69 @@
+// Prioritized reparsing after compile data changes
+// Author: Max Schwarz <max.schwarz@online.de>
+
+#include "colcon_reparse_scheduler.h"
+
+#include "colcon_project_data.h"
+
+#include <interfaces/icore.h>
+#include <interfaces/idocument.h>
+#include <interfaces/idocumentcontroller.h>
+#include <interfaces/ilanguagecontroller.h>
+#include <interfaces/iproject.h>
+#include <language/backgroundparser/backgroundparser.h>
+#include <language/duchain/topducontext.h>
+#include <serialization/indexedstring.h>
+
+#include <debug.h>
+
+using namespace KDevelop;
+
+void ColconReparseScheduler::schedule(
+    IProject* project,
+    const ColconFilesCompilationData& data,
+    const QSet<Path>& changedFiles,
+    const QSet<QString>& builtPackages)
+{
+    BackgroundParser* parser = ICore::self()->languageController()->backgroundParser();
+    IDocumentController* documents = ICore::self()->documentController();
+
+    // The compile flags changed, not the file contents, so we have to force
+    // the update. Each file is queued once, with its best priority.
+    QSet<IndexedString> scheduled;
+    auto add = [&](const IndexedString& url, TopDUContext::Features features, int priority) {
+        if(scheduled.contains(url))
+            return;
+
+        scheduled.insert(url);
+        parser->addDocument(url, TopDUContext::Features(features | TopDUContext::ForceUpdate), priority);
+    };
+
+    if(IDocument* active = documents->activeDocument())
+    {
+        const IndexedString url{active->url()};
+        if(project->inProject(url))
+            add(url, TopDUContext::AllDeclarationsContextsAndUses, BackgroundParser::BestPriority);
+    }
+
+    const auto openDocuments = documents->openDocuments();
+    for(IDocument* document : openDocuments)
+    {
+        const IndexedString url{document->url()};
+        if(project->inProject(url))
+            add(url, TopDUContext::AllDeclarationsContextsAndUses, BackgroundParser::BestPriority + 1);
+    }
+
+    if(!builtPackages.isEmpty())
+    {
+        for(auto it = data.files.constBegin(), end = data.files.constEnd(); it != end; ++it)
+        {
+            if(builtPackages.contains(it->package))
+                add(IndexedString{it.key().toUrl()}, TopDUContext::VisibleDeclarationsAndContexts, BackgroundParser::NormalPriority);
+        }
+    }
+
+    for(const Path& path : changedFiles)
+        add(IndexedString{path.toUrl()}, TopDUContext::VisibleDeclarationsAndContexts, BackgroundParser::WorstPriority);
+
+    qCDebug(COLCON) << "Scheduled" << scheduled.count() << "files for reparsing";
+}
@@ -0,0 +1,38 @@
+// Prioritized reparsing after compile data changes
+// Author: Max Schwarz <max.schwarz@online.de>
+
+#ifndef COLCON_REPARSE_SCHEDULER_H
+#define COLCON_REPARSE_SCHEDULER_H
+
+#include <util/path.h>
+
+#include <QSet>
+
+namespace KDevelop
+{
+    class IProject;
+}
+
+class ColconFilesCompilationData;
+
+/**
+ * Queues files for reparsing in the background parser, ordered by how
+ * likely the developer is to be looking at them:
+ *
+ *  1. the active document
+ *  2. other open documents of the project
+ *  3. files of the packages that were just built
+ *  4. all other files with changed compile data, at low priority
+ */
+class ColconReparseScheduler
+{
+public:
+    static void schedule(
+        KDevelop::IProject* project,
+        const ColconFilesCompilationData& data,
+        const QSet<KDevelop::Path>& changedFiles,
+        const QSet<QString>& builtPackages
+    );
+};
+
+#endif
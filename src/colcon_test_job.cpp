@@ -0,0 +1,123 @@
+// Test job
+// Author: Max Schwarz <max.schwarz@online.de>
+
+#include "colcon_test_job.h"
+
+#include "colcon_build_settings.h"
+
+#include <KLocalizedString>
+#include <KShell>
+
+#include <interfaces/iproject.h>
+#include <outputview/outputmodel.h>
+#include <util/path.h>
+
+#include <QRegularExpression>
+
+#include <debug.h>
+
+ColconTestJob::ColconTestJob(KDevelop::IProject* project, const QStringList& packages, QObject* parent)
+ : OutputExecuteJob{parent}
+ , m_packages{packages}
+{
+    setToolTitle(i18n("Colcon Test"));
+    setCapabilities(Killable);
+    setStandardToolView(KDevelop::IOutputView::TestView);
+    setBehaviours(KDevelop::IOutputView::AllowUserClose | KDevelop::IOutputView::AutoScroll);
+    setFilteringStrategy(KDevelop::OutputModel::CompilerFilter);
+    setProperties(NeedWorkingDirectory | PortableMessages | DisplayStderr | PostProcessOutput);
+
+    addEnvironmentOverride(QStringLiteral("PYTHONUNBUFFERED"), QStringLiteral("1"));
+
+    const ColconBuildSettings settings = ColconBuildSettings::fromProject(project).resolved();
+
+    QStringList quoted;
+    for(const QString& package : packages)
+        quoted << KShell::quoteArg(package);
+
+    // colcon is called directly here instead of through .build.sh, so spell
+    // out the workspace layout the plugin relies on elsewhere: packages
+    // below the project directory, build/ and install/ next to it.
+    const QString basePaths = QStringLiteral("--base-paths ") + KShell::quoteArg(project->path().toLocalFile());
+
+    // --packages-above selects the packages and all their reverse
+    // dependencies. test-result prints the failure messages, which contain
+    // file:line locations, and determines the exit code. It is restricted
+    // to the tested packages, stale results of other packages in the build
+    // base must not fail the job.
+    *this << "bash"
+        << "-c"
+        << QStringLiteral(
+        "if [ -f install/setup.bash ]; then . install/setup.bash; fi;"
+        " colcon test %1 --build-base build --install-base install"
+        " --packages-above %2"
+        " --parallel-workers %3"
+        " --event-handlers status+ console_start_end+"
+        " | stdbuf -o0 tr '\\r' '\\n';"
+        " ret=0;"
+        " for package in $(colcon list --names-only %1 --packages-above %2); do"
+        " if [ -d \"build/$package\" ]; then"
+        " colcon test-result --verbose --test-result-base \"build/$package\" || ret=1;"
+        " fi;"
+        " done;"
+        " exit $ret").arg(basePaths, quoted.join(QLatin1Char(' ')), QString::number(settings.testWorkers));
+
+    QString title = i18nc("Testing: <project name>", "Testing: %1", project->name());
+    setJobName(title);
+
+    setWorkingDirectory(project->path().parent().toUrl());
+}
+
+void ColconTestJob::postProcessStderr(const QStringList& lines)
+{
+    appendLines(lines);
+}
+
+void ColconTestJob::postProcessStdout(const QStringList& lines)
+{
+    appendLines(lines);
+}
+
+void ColconTestJob::appendLines(const QStringList& lines)
+{
+    static const QRegularExpression statusRe(QStringLiteral(
+        R"EOS(^\[[^\]]+\] \[([0-9]+)\/([0-9]+) complete\](.*))EOS"));
+    static const QRegularExpression summaryRe(QStringLiteral(
+        R"EOS(^Summary: ([0-9]+) tests?, ([0-9]+) errors?, ([0-9]+) failures?, ([0-9]+) skipped)EOS"));
+
+    QStringList ret(lines);
+    for(QStringList::iterator it = ret.begin(); it != ret.end(); )
+    {
+        if(it->trimmed().isEmpty())
+        {
+            it = ret.erase(it);
+            continue;
+        }
+
+        QRegularExpressionMatch match = statusRe.match(it->trimmed());
+        if(match.hasMatch())
+        {
+            emitPercent(match.capturedRef(1).toInt(), match.capturedRef(2).toInt());
+            infoMessage(this, match.captured(3));
+            it = ret.erase(it);
+            continue;
+        }
+
+        // test-result runs once per package, sum up the summaries
+        match = summaryRe.match(*it);
+        if(match.hasMatch())
+        {
+            m_tests += match.capturedRef(1).toInt();
+            m_errors += match.capturedRef(2).toInt();
+            m_failures += match.capturedRef(3).toInt();
+            m_skipped += match.capturedRef(4).toInt();
+
+            infoMessage(this, i18n("%1 tests, %2 errors, %3 failures, %4 skipped",
+                m_tests, m_errors, m_failures, m_skipped));
+        }
+
+        it++;
+    }
+
+    model()->appendLines(ret);
+}
@@ -0,0 +1,46 @@
+// Test job
+// Author: Max Schwarz <max.schwarz@online.de>
+
+#ifndef COLCON_TEST_JOB_H
+#define COLCON_TEST_JOB_H
+
+#include <outputview/outputexecutejob.h>
+
+#include <QStringList>
+
+namespace KDevelop
+{
+    class IProject;
+}
+
+/**
+ * Runs colcon test for the given packages and everything depending on them,
+ * followed by colcon test-result for each of the tested packages. Failure
+ * locations in the test output are navigable through the compiler filter.
+ * The packages have to be built beforehand.
+ */
+class ColconTestJob : public KDevelop::OutputExecuteJob
+{
+Q_OBJECT
+public:
+    ColconTestJob(KDevelop::IProject* project, const QStringList& packages, QObject* parent = nullptr);
+
+    QStringList packages() const
+    { return m_packages; }
+
+protected Q_SLOTS:
+    void postProcessStdout(const QStringList& lines) override;
+    void postProcessStderr(const QStringList& lines) override;
+
+private:
+    void appendLines(const QStringList& lines);
+
+    QStringList m_packages;
+
+    int m_tests = 0;
+    int m_errors = 0;
+    int m_failures = 0;
+    int m_skipped = 0;
+};
+
+#endif